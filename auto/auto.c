@@ -0,0 +1,297 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "auto.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#if defined(ZX0_NO_THREADS) || defined(ZX7_NO_THREADS)
+#define ZX_NO_THREADS
+#endif
+
+#ifndef ZX_NO_THREADS
+#include <pthread.h>
+#endif
+
+#define ZX_MAX_THREADS 64
+
+typedef struct zx_run_t {
+    const unsigned char *input_data;
+    const unsigned char *reversed;      /* the input backwards, for the backwards candidates */
+    int input_size;
+    const zx_CANDIDATE *candidates;
+    int *order;                         /* the candidates that run, in the order they are taken */
+    int nr_order;
+    int next;
+    const zx0_OPTIONS *options;
+    int ceiling;                        /* size of the best stream so far, INT_MAX before the first */
+    int failed;
+    zx_AUTO *result;
+#ifndef ZX_NO_THREADS
+    pthread_mutex_t lock;
+#endif
+} zx_RUN;
+
+static double zx_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+static void zx_reverse(unsigned char *first, unsigned char *last) {
+    unsigned char c;
+
+    while (first < last) {
+        c = *first;
+        *first++ = *last;
+        *last-- = c;
+    }
+}
+
+int zx_default_candidates(zx_CANDIDATE *candidates, int skip) {
+    static const int modes[ZX_DEFAULT_CANDIDATES][3] = {
+        { 0, 0, 1 }, { 0, 0, 0 }, { 0, 1, 0 }, { 0, 1, 1 }, { 7, 0, 0 }, { 7, 1, 0 }
+    };
+    int i;
+
+    for (i = 0; i < ZX_DEFAULT_CANDIDATES; i++) {
+        candidates[i].format = modes[i][0];
+        candidates[i].skip = skip;
+        candidates[i].backwards_mode = modes[i][1];
+        candidates[i].invert_mode = modes[i][2];
+    }
+    return ZX_DEFAULT_CANDIDATES;
+}
+
+/* keep the stream of candidate index if it is the best so far, and lower the ceiling to its size */
+static void zx_offer(zx_RUN *run, int index, unsigned char *output_data, int output_size, long delta) {
+    zx_AUTO *result = run->result;
+
+#ifndef ZX_NO_THREADS
+    pthread_mutex_lock(&run->lock);
+#endif
+    if (!result->output_data || output_size < result->output_size ||
+        (output_size == result->output_size && index < result->winner)) {
+        free(result->output_data);
+        result->output_data = output_data;
+        result->output_size = output_size;
+        result->delta = delta;
+        result->winner = index;
+        __atomic_store_n(&run->ceiling, output_size, __ATOMIC_RELAXED);
+    } else {
+        free(output_data);
+    }
+#ifndef ZX_NO_THREADS
+    pthread_mutex_unlock(&run->lock);
+#endif
+}
+
+static void *zx_auto_worker(void *arg) {
+    zx_RUN *run = arg;
+    zx0_CONTEXT *zx0_context = NULL;
+    zx7_CONTEXT *zx7_context = NULL;
+    const zx_CANDIDATE *candidate;
+    const unsigned char *input_data;
+    unsigned char *output_data;
+    zx0_OPTIONS settings;
+    zx0_STATS zx0_stats;
+    zx7_STATS zx7_stats;
+    int output_size;
+    int zx0_delta;
+    long delta;
+    int aborted;
+    int index;
+
+    memset(&settings, 0, sizeof settings);
+    if (run->options)
+        settings = *run->options;
+    settings.stats = &zx0_stats;
+    settings.arena = NULL;
+    settings.ceiling = &run->ceiling;
+
+    /* contexts are only created for the formats this worker takes, then reused */
+    for (;;) {
+        index = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED);
+        if (index >= run->nr_order) {
+            break;
+        }
+        index = run->order[index];
+        candidate = &run->candidates[index];
+        input_data = candidate->backwards_mode ? run->reversed : run->input_data;
+        output_data = NULL;
+        aborted = 0;
+
+        if (candidate->format == 7) {
+            if (!zx7_context) {
+                zx7_context = zx7_context_create();
+                if (zx7_context) {
+                    zx7_context_threads(zx7_context, settings.threads);
+                    zx7_context_ceiling(zx7_context, &run->ceiling);
+                }
+            }
+            if (zx7_context) {
+                output_data = zx7_context_compress(zx7_context, input_data, run->input_size, candidate->skip, &output_size, &delta);
+                zx7_context_stats(zx7_context, &zx7_stats);
+                aborted = !output_data && zx7_stats.ceiling_index >= 0;
+            }
+        } else {
+            if (!zx0_context)
+                zx0_context = zx0_context_create();
+            if (zx0_context) {
+                zx0_stats.ceiling_index = -1;
+                output_data = zx0_context_compress(zx0_context, input_data, run->input_size, candidate->skip, candidate->backwards_mode,
+                                                   candidate->invert_mode, &output_size, &zx0_delta, NULL, &settings);
+                delta = zx0_delta;
+                aborted = !output_data && zx0_stats.ceiling_index >= 0;
+            }
+        }
+
+        if (output_data) {
+            zx_offer(run, index, output_data, output_size, delta);
+        } else if (aborted) {
+            __atomic_add_fetch(&run->result->aborted, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&run->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    zx0_context_free(zx0_context);
+    zx7_context_free(zx7_context);
+
+    return NULL;
+}
+
+int zx_compress_auto(const unsigned char *input_data, int input_size, const zx_CANDIDATE *candidates, int nr_candidates, int threads, const zx0_OPTIONS *options, zx_AUTO *result)
+{
+    zx_RUN run;
+    unsigned char *reversed = NULL;
+#ifndef ZX_NO_THREADS
+    pthread_t thread[ZX_MAX_THREADS];
+    int started = 0;
+#endif
+    double start = zx_seconds();
+    int backwards = 0;
+    int format;
+    int i;
+    int j;
+
+    memset(result, 0, sizeof *result);
+    result->winner = -1;
+    if (nr_candidates <= 0) {
+        return 0;
+    }
+
+    memset(&run, 0, sizeof run);
+    run.input_data = input_data;
+    run.input_size = input_size;
+    run.candidates = candidates;
+    run.options = options;
+    run.ceiling = INT_MAX;
+    run.result = result;
+    run.order = malloc(nr_candidates*sizeof(int));
+    if (!run.order) {
+        return nr_candidates;
+    }
+
+    /*
+     * zx7 first, it takes a fraction of the time of zx0 and sets a ceiling early; a candidate with an earlier
+     * twin, or a skip past the input, does not run at all
+     */
+    for (format = 7; format >= 0; format -= 7) {
+        for (i = 0; i < nr_candidates; i++) {
+            if ((candidates[i].format == 7) != (format == 7)) {
+                continue;
+            }
+            if (candidates[i].skip < 0 || candidates[i].skip >= input_size) {
+                run.failed++;
+                continue;
+            }
+            for (j = 0; j < i; j++) {
+                if ((candidates[j].format == 7) == (format == 7) && candidates[j].skip == candidates[i].skip &&
+                    candidates[j].backwards_mode == candidates[i].backwards_mode) {
+                    break;
+                }
+            }
+            if (j == i) {
+                run.order[run.nr_order++] = i;
+                backwards |= candidates[i].backwards_mode;
+            }
+        }
+    }
+
+    /* backwards compression takes the data reversed, which needs a copy of its own */
+    if (backwards) {
+        reversed = malloc(input_size);
+        if (!reversed) {
+            free(run.order);
+            return nr_candidates;
+        }
+        memcpy(reversed, input_data, input_size);
+        zx_reverse(reversed, reversed+input_size-1);
+        run.reversed = reversed;
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > ZX_MAX_THREADS) {
+        threads = ZX_MAX_THREADS;
+    }
+    if (threads > run.nr_order) {
+        threads = run.nr_order;
+    }
+
+#ifndef ZX_NO_THREADS
+    /* the calling thread is a worker too, the others take what it does not */
+    pthread_mutex_init(&run.lock, NULL);
+    for (i = 1; i < threads; i++) {
+        if (!pthread_create(&thread[started], NULL, zx_auto_worker, &run)) {
+            started++;
+        }
+    }
+    zx_auto_worker(&run);
+    for (i = 0; i < started; i++) {
+        pthread_join(thread[i], NULL);
+    }
+    pthread_mutex_destroy(&run.lock);
+#else
+    zx_auto_worker(&run);
+#endif
+
+    /* a backwards stream comes out reversed as well */
+    if (result->output_data && candidates[result->winner].backwards_mode) {
+        zx_reverse(result->output_data, result->output_data+result->output_size-1);
+    }
+    result->seconds = zx_seconds()-start;
+
+    free(reversed);
+    free(run.order);
+    return run.failed;
+}
@@ -0,0 +1,67 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ZX_AUTO_H
+#define ZX_AUTO_H
+
+#include "../zx0/zx0.h"
+#include "../zx7/zx7.h"
+
+/* one way to compress an input */
+typedef struct zx_candidate_t {
+    int format;         /* 0 for zx0, 7 for zx7 */
+    int skip;           /* bytes at the start used only as a prefix (at the end backwards) */
+    int backwards_mode; /* a stream for the backwards decompressor */
+    int invert_mode;    /* zx0 only */
+} zx_CANDIDATE;
+
+#define ZX_DEFAULT_CANDIDATES 6
+
+/*
+ * Fill candidates with zx0 forwards, classic, backwards and backwards inverted, then zx7 forwards and
+ * backwards, all with the same skip. Returns ZX_DEFAULT_CANDIDATES.
+ */
+int zx_default_candidates(zx_CANDIDATE *candidates, int skip);
+
+typedef struct zx_auto_t {
+    unsigned char *output_data;     /* the smallest stream, ready for its decompressor, NULL if none finished */
+    int output_size;
+    long delta;
+    int winner;                     /* index of its candidate, the first one on a tie */
+    int aborted;                    /* candidates given up partway, sure to lose */
+    double seconds;
+} zx_AUTO;
+
+/*
+ * Compress input_data every way of candidates on up to threads threads and keep the smallest stream. zx0
+ * candidates take options (may be NULL, its stats and arena are not used), zx7 ones only its threads. The
+ * size of the best stream so far is the ceiling of every parse still running, so one sure to end up larger
+ * gives up partway; candidates that differ only in invert_mode come out the same size, so only the first
+ * of them runs. Returns the number of candidates that failed otherwise (out of memory, or skip past the
+ * input); the caller frees result->output_data.
+ */
+int zx_compress_auto(const unsigned char *input_data, int input_size, const zx_CANDIDATE *candidates, int nr_candidates, int threads, const zx0_OPTIONS *options, zx_AUTO *result);
+
+#endif
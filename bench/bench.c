@@ -0,0 +1,554 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for both formats, built from this file and every source of zx0 and zx7. It compresses a small
+ * corpus generated on the spot (the same bytes on every host) plus any files given, each in a process of its
+ * own so peak memory is per run, checks that every stream decompresses back, and prints one row per input
+ * and format as CSV or JSON for tracking regressions over time.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../zx0/zx0.h"
+#include "../zx7/zx7.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define ZX_CORPUS_SIZE 8
+
+typedef struct zx_asset_t {
+    const char *name;
+    unsigned char *data;
+    int size;
+} zx_ASSET;
+
+/* what one run measured, passed back from its process as is */
+typedef struct zx_result_t {
+    int ok;                     /* compressed and decompressed back to the input */
+    int output_size;
+    long delta;
+    double seconds;             /* fastest of the repeats */
+    long peak_rss;              /* kilobytes */
+    long blocks;                /* zx0 blocks allocated */
+    long arena_bytes;
+    long finder_steps;          /* zx7 match finder steps */
+} zx_RESULT;
+
+typedef struct zx_settings_t {
+    int level;
+    int threads;
+    int chain;                  /* zx7 hash chain finder instead of the tree */
+    int repeats;
+} zx_SETTINGS;
+
+static double zx_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+/* the same numbers on every host, unlike rand() */
+static unsigned zx_random(unsigned *state) {
+    *state = *state*1103515245u + 12345u;
+    return *state >> 16;
+}
+
+/* 8x8 tiles, mostly blank with a few shapes, 8 bytes per tile like a ZX Spectrum tile set */
+static void zx_tiles(unsigned char *data, int size, unsigned *state) {
+    int i;
+    int j;
+
+    memset(data, 0, size);
+    for (i = 0; i+8 <= size; i += 8) {
+        if (zx_random(state) % 4 == 0) {
+            for (j = 0; j < 8; j++) {
+                data[i+j] = (unsigned char)(zx_random(state) % 3 ? 0x18u << (zx_random(state) % 3) : zx_random(state));
+            }
+        }
+    }
+}
+
+/* a ZX Spectrum screen: bitmap of text-like glyph rows, then attributes in runs */
+static void zx_screen(unsigned char *data, int size, unsigned *state) {
+    static const unsigned char glyphs[4][8] = {
+        { 0x00, 0x3c, 0x42, 0x42, 0x7e, 0x42, 0x42, 0x00 },
+        { 0x00, 0x7c, 0x42, 0x7c, 0x42, 0x42, 0x7c, 0x00 },
+        { 0x00, 0x3c, 0x42, 0x40, 0x40, 0x42, 0x3c, 0x00 },
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
+    };
+    int bitmap = size*8/9;
+    unsigned char ink = 0x38;
+    int i;
+
+    for (i = 0; i < bitmap; i++) {
+        /* lines of a character row are 256 bytes apart, as on the Spectrum */
+        data[i] = glyphs[(i & 31) * 7 % 5 % 4][(i >> 8) & 7];
+    }
+    for (; i < size; i++) {
+        if (zx_random(state) % 16 == 0) {
+            ink = (unsigned char)(zx_random(state) & 0x7f);
+        }
+        data[i] = ink;
+    }
+}
+
+/* a lookup table of 16-bit entries, each record padded with 0xff */
+static void zx_table(unsigned char *data, int size, unsigned *state) {
+    unsigned value = 0x8000;
+    int i;
+
+    memset(data, 0xff, size);
+    for (i = 0; i+8 <= size; i += 8) {
+        value += zx_random(state) % 64;
+        data[i] = (unsigned char)value;
+        data[i+1] = (unsigned char)(value >> 8);
+        data[i+2] = (unsigned char)(i >> 3);
+    }
+}
+
+/* game text, sentences of a small vocabulary */
+static void zx_text(unsigned char *data, int size, unsigned *state) {
+    static const char *words[] = {
+        "the", "you", "are", "in", "a", "dark", "room", "there", "is", "door", "to", "north", "key", "lamp",
+        "take", "open", "cannot", "see", "here", "and", "small", "old", "chest", "west", "east", "stairs"
+    };
+    const char *word;
+    int i = 0;
+    int length;
+
+    while (i < size) {
+        word = words[zx_random(state) % (sizeof words / sizeof *words)];
+        length = (int)strlen(word);
+        if (i+length+1 > size) {
+            break;
+        }
+        memcpy(data+i, word, length);
+        i += length;
+        data[i++] = zx_random(state) % 9 ? ' ' : '.';
+    }
+    memset(data+i, ' ', size-i);
+}
+
+/* Z80 code: common opcodes, with addresses and immediates that repeat often */
+static void zx_code(unsigned char *data, int size, unsigned *state) {
+    static const unsigned char opcodes[] = {
+        0x3e, 0x21, 0x11, 0xcd, 0xc9, 0x7e, 0x23, 0x77, 0x10, 0x18, 0x20, 0x28, 0xfe, 0xe6, 0x3a, 0x32, 0xc5, 0xc1
+    };
+    unsigned char opcode;
+    int i = 0;
+
+    while (i+3 <= size) {
+        opcode = opcodes[zx_random(state) % sizeof opcodes];
+        data[i++] = opcode;
+        if (opcode == 0x21 || opcode == 0x11 || opcode == 0xcd || opcode == 0x3a || opcode == 0x32) {
+            data[i++] = (unsigned char)(zx_random(state) % 8 * 16);
+            data[i++] = (unsigned char)(0x80 + zx_random(state) % 4);
+        } else if (opcode == 0x3e || opcode == 0x10 || opcode == 0x18 || opcode == 0x20 || opcode == 0x28 ||
+                   opcode == 0xfe || opcode == 0xe6) {
+            data[i++] = (unsigned char)(zx_random(state) % 16);
+        }
+    }
+    memset(data+i, 0, size-i);
+}
+
+/* masked sprite frames, each one the previous shifted by a pixel */
+static void zx_sprites(unsigned char *data, int size, unsigned *state) {
+    unsigned char frame[32];
+    int i;
+    int j;
+
+    for (j = 0; j < 32; j++) {
+        frame[j] = (unsigned char)(zx_random(state) & 0x7e);
+    }
+    for (i = 0; i < size; i++) {
+        j = i % 64;
+        if (j == 0 && i) {
+            for (j = 0; j < 32; j++) {
+                frame[j] = (unsigned char)(frame[j] >> 1 | (j && frame[j-1] & 1) << 7);
+            }
+            j = 0;
+        }
+        /* mask and graphic bytes interleaved */
+        data[i] = j & 1 ? frame[j/2] : (unsigned char)~(frame[j/2] | frame[j/2] << 1 | frame[j/2] >> 1);
+    }
+}
+
+/* noise, which hardly compresses */
+static void zx_noise(unsigned char *data, int size, unsigned *state) {
+    int i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = (unsigned char)zx_random(state);
+    }
+}
+
+/* padding with a few bytes set, the long runs that once made the match finders quadratic */
+static void zx_runs(unsigned char *data, int size, unsigned *state) {
+    int i;
+
+    memset(data, 0, size);
+    for (i = 0; i < size/1024; i++) {
+        data[zx_random(state) % size] = (unsigned char)zx_random(state);
+    }
+}
+
+static int zx_corpus(zx_ASSET *assets) {
+    static const struct {
+        const char *name;
+        int size;
+        void (*make)(unsigned char *data, int size, unsigned *state);
+    } kinds[ZX_CORPUS_SIZE] = {
+        { "tiles", 6144, zx_tiles },
+        { "screen", 6912, zx_screen },
+        { "table", 4096, zx_table },
+        { "text", 8192, zx_text },
+        { "code", 8192, zx_code },
+        { "sprites", 4096, zx_sprites },
+        { "noise", 4096, zx_noise },
+        { "runs", 16384, zx_runs }
+    };
+    unsigned state;
+    int i;
+
+    for (i = 0; i < ZX_CORPUS_SIZE; i++) {
+        assets[i].name = kinds[i].name;
+        assets[i].size = kinds[i].size;
+        assets[i].data = malloc(kinds[i].size);
+        if (!assets[i].data) {
+            return 0;
+        }
+        state = 1+i;
+        kinds[i].make(assets[i].data, kinds[i].size, &state);
+    }
+    return 1;
+}
+
+static int zx_read(const char *name, zx_ASSET *asset) {
+    FILE *file;
+    long size;
+
+    file = fopen(name, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot access input file %s\n", name);
+        return 0;
+    }
+    if (fseek(file, 0, SEEK_END) || (size = ftell(file)) <= 0 || size > INT_MAX || fseek(file, 0, SEEK_SET)) {
+        fprintf(stderr, "Error: Input file %s is empty or too large\n", name);
+        fclose(file);
+        return 0;
+    }
+    asset->name = name;
+    asset->size = (int)size;
+    asset->data = malloc(size);
+    if (!asset->data || fread(asset->data, size, 1, file) != 1) {
+        fprintf(stderr, "Error: Cannot read input file %s\n", name);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    return 1;
+}
+
+static int zx_write_corpus(const zx_ASSET *assets, const char *dir) {
+    char *name;
+    FILE *file;
+    int written;
+    int i;
+
+    for (i = 0; i < ZX_CORPUS_SIZE; i++) {
+        name = malloc(strlen(dir)+strlen(assets[i].name)+6);
+        if (!name) {
+            return 0;
+        }
+        sprintf(name, "%s/%s.bin", dir, assets[i].name);
+        file = fopen(name, "wb");
+        written = file && fwrite(assets[i].data, assets[i].size, 1, file) == 1;
+        if ((file && fclose(file)) || !written) {
+            fprintf(stderr, "Error: Cannot write output file %s\n", name);
+            free(name);
+            return 0;
+        }
+        free(name);
+    }
+    return 1;
+}
+
+static long zx_peak_rss(void) {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss/1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+/* compress asset in format repeats times and check the last stream */
+static void zx_measure(const zx_ASSET *asset, int format, const zx_SETTINGS *settings, zx_RESULT *result) {
+    zx0_OPTIONS options;
+    zx0_STATS zx0_stats;
+    zx7_STATS zx7_stats;
+    zx7_CONTEXT *context = NULL;
+    unsigned char *output_data = NULL;
+    unsigned char *decompressed = NULL;
+    double start;
+    double seconds;
+    int zx0_delta;
+    int size;
+    int i;
+
+    memset(result, 0, sizeof *result);
+    memset(&options, 0, sizeof options);
+    options.level = settings->level;
+    options.threads = settings->threads;
+    options.stats = &zx0_stats;
+    if (format == 7) {
+        context = zx7_context_create();
+        if (!context || !zx7_context_finder(context, settings->chain ? ZX7_FINDER_CHAIN : ZX7_FINDER_TREE)) {
+            zx7_context_free(context);
+            return;
+        }
+        zx7_context_threads(context, settings->threads);
+    }
+
+    for (i = 0; i < settings->repeats; i++) {
+        free(output_data);
+        start = zx_seconds();
+        if (format == 7) {
+            output_data = zx7_context_compress(context, asset->data, asset->size, 0, &result->output_size, &result->delta);
+        } else {
+            output_data = zx0_compress_ex(asset->data, asset->size, 0, 0, 1, &result->output_size, &zx0_delta, NULL, &options);
+            result->delta = zx0_delta;
+        }
+        seconds = zx_seconds()-start;
+        if (!output_data) {
+            zx7_context_free(context);
+            return;
+        }
+        if (!i || seconds < result->seconds) {
+            result->seconds = seconds;
+        }
+    }
+
+    if (format == 7) {
+        zx7_context_stats(context, &zx7_stats);
+        result->finder_steps = zx7_stats.finder_steps;
+        decompressed = zx7_decompress(output_data, result->output_size, NULL, 0, &size);
+    } else {
+        result->blocks = zx0_stats.blocks_allocated;
+        result->arena_bytes = (long)zx0_stats.arena_bytes;
+        decompressed = zx0_decompress(output_data, result->output_size, NULL, 0, 0, 1, &size);
+    }
+    result->ok = decompressed && size == asset->size && !memcmp(decompressed, asset->data, size);
+    result->peak_rss = zx_peak_rss();
+
+    free(decompressed);
+    free(output_data);
+    zx7_context_free(context);
+}
+
+/* a process of its own per run, so the peak memory of one does not carry over to the next */
+static void zx_run(const zx_ASSET *asset, int format, const zx_SETTINGS *settings, zx_RESULT *result) {
+    int channel[2];
+    pid_t child;
+    int status;
+    ssize_t got;
+
+    if (pipe(channel)) {
+        zx_measure(asset, format, settings, result);
+        return;
+    }
+    child = fork();
+    if (child < 0) {
+        close(channel[0]);
+        close(channel[1]);
+        zx_measure(asset, format, settings, result);
+        return;
+    }
+    if (!child) {
+        close(channel[0]);
+        zx_measure(asset, format, settings, result);
+        _exit(write(channel[1], result, sizeof *result) == (ssize_t)sizeof *result ? 0 : 1);
+    }
+    close(channel[1]);
+    got = read(channel[0], result, sizeof *result);
+    close(channel[0]);
+    waitpid(child, &status, 0);
+    if (got != (ssize_t)sizeof *result) {
+        memset(result, 0, sizeof *result);
+    }
+}
+
+static void zx_print(FILE *out, int json, int first, const zx_ASSET *asset, int format, const zx_RESULT *result) {
+    double ratio = (double)result->output_size/asset->size;
+    double speed = result->seconds > 0 ? asset->size/1024.0/result->seconds : 0;
+
+    if (json) {
+        fprintf(out, "%s\n  {\"input\": \"%s\", \"format\": \"zx%d\", \"input_bytes\": %d, \"output_bytes\": %d, "
+                "\"ratio\": %.4f, \"delta\": %ld, \"seconds\": %.6f, \"kb_per_s\": %.1f, \"peak_rss_kb\": %ld, "
+                "\"blocks\": %ld, \"arena_bytes\": %ld, \"finder_steps\": %ld, \"ok\": %s}",
+                first ? "" : ",", asset->name, format, asset->size, result->output_size, ratio, result->delta,
+                result->seconds, speed, result->peak_rss, result->blocks, result->arena_bytes, result->finder_steps,
+                result->ok ? "true" : "false");
+    } else {
+        fprintf(out, "%s,zx%d,%d,%d,%.4f,%ld,%.6f,%.1f,%ld,%ld,%ld,%ld,%d\n", asset->name, format, asset->size,
+                result->output_size, ratio, result->delta, result->seconds, speed, result->peak_rss, result->blocks,
+                result->arena_bytes, result->finder_steps, result->ok);
+    }
+}
+
+static void zx_usage(void) {
+    fprintf(stderr, "Usage: zxbench [options] [input...]\n"
+                    "  -0          zx0 only\n"
+                    "  -7          zx7 only\n"
+                    "  -l level    zx0 compression level 1-9 (default: the full window)\n"
+                    "  -t threads  zx0 sweep threads and zx7 finder threads\n"
+                    "  -c          zx7 hash chain finder instead of the tree\n"
+                    "  -n repeats  time the fastest of this many compressions of each input\n"
+                    "  -x          inputs only, without the generated corpus\n"
+                    "  -J          JSON instead of CSV\n"
+                    "  -w dir      write the generated corpus to dir and stop\n");
+}
+
+int main(int argc, char *argv[]) {
+    zx_SETTINGS settings;
+    zx_ASSET *assets;
+    zx_RESULT result;
+    const char *corpus_dir = NULL;
+    int formats[2] = { 0, 7 };
+    int first_format = 0;
+    int last_format = 1;
+    int corpus = 1;
+    int json = 0;
+    int nr_assets = 0;
+    int failed = 0;
+    int first = 1;
+    int i;
+    int j;
+
+    memset(&settings, 0, sizeof settings);
+    settings.threads = 1;
+    settings.repeats = 1;
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (!strcmp(argv[i], "-0")) {
+            last_format = 0;
+        } else if (!strcmp(argv[i], "-7")) {
+            first_format = 1;
+        } else if (!strcmp(argv[i], "-c")) {
+            settings.chain = 1;
+        } else if (!strcmp(argv[i], "-x")) {
+            corpus = 0;
+        } else if (!strcmp(argv[i], "-J")) {
+            json = 1;
+        } else if (i+1 < argc && !strcmp(argv[i], "-l")) {
+            settings.level = atoi(argv[++i]);
+            if (settings.level < ZX0_MIN_LEVEL || settings.level > ZX0_MAX_LEVEL) {
+                fprintf(stderr, "Error: Invalid level %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i+1 < argc && !strcmp(argv[i], "-t")) {
+            settings.threads = atoi(argv[++i]);
+            if (settings.threads < 1) {
+                fprintf(stderr, "Error: Invalid number of threads %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i+1 < argc && !strcmp(argv[i], "-n")) {
+            settings.repeats = atoi(argv[++i]);
+            if (settings.repeats < 1) {
+                fprintf(stderr, "Error: Invalid number of repeats %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i+1 < argc && !strcmp(argv[i], "-w")) {
+            corpus_dir = argv[++i];
+        } else {
+            zx_usage();
+            return 1;
+        }
+    }
+    if (first_format > last_format) {
+        fprintf(stderr, "Error: Options -0 and -7 exclude each other\n");
+        return 1;
+    }
+
+    assets = calloc(ZX_CORPUS_SIZE+argc-i, sizeof(zx_ASSET));
+    if (!assets || !zx_corpus(assets)) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        return 1;
+    }
+    if (corpus_dir) {
+        return zx_write_corpus(assets, corpus_dir) ? 0 : 1;
+    }
+    if (corpus) {
+        nr_assets = ZX_CORPUS_SIZE;
+    } else {
+        for (j = 0; j < ZX_CORPUS_SIZE; j++) {
+            free(assets[j].data);
+        }
+    }
+    for (; i < argc; i++) {
+        if (!zx_read(argv[i], &assets[nr_assets++])) {
+            return 1;
+        }
+    }
+    if (!nr_assets) {
+        zx_usage();
+        return 1;
+    }
+
+    if (json) {
+        printf("[");
+    } else {
+        printf("input,format,input_bytes,output_bytes,ratio,delta,seconds,kb_per_s,peak_rss_kb,blocks,arena_bytes,finder_steps,ok\n");
+    }
+    fflush(stdout);
+    for (i = 0; i < nr_assets; i++) {
+        for (j = first_format; j <= last_format; j++) {
+            zx_run(&assets[i], formats[j], &settings, &result);
+            zx_print(stdout, json, first, &assets[i], formats[j], &result);
+            fflush(stdout);
+            failed += !result.ok;
+            first = 0;
+        }
+        free(assets[i].data);
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+    free(assets);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,520 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Command line driver for both formats, built from this file and every source of zx0 and zx7. Inputs are
+ * mapped rather than read, compressed on a pool of jobs and each output is written to a temporary file
+ * renamed over the final name, so an interrupted run never leaves a truncated output behind.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../zx0/zx0.h"
+#include "../zx7/zx7.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct zx_file_t {
+    const char *input_name;
+    char *output_name;
+    const unsigned char *input_data;    /* the mapping, or the reversed copy in backwards mode */
+    size_t mapped_size;
+    int input_size;
+    int reversed;
+} zx_FILE;
+
+typedef struct zx_job_t {
+    zx_FILE *files;
+    zx0_ITEM *zx0_items;
+    zx7_ITEM *zx7_items;
+    int backwards_mode;
+    int report;
+    int failed;
+    long input_total;
+    long output_total;
+} zx_JOB;
+
+static double zx_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+static void zx_reverse(unsigned char *first, unsigned char *last) {
+    unsigned char c;
+
+    while (first < last) {
+        c = *first;
+        *first++ = *last;
+        *last-- = c;
+    }
+}
+
+static int zx_map(zx_FILE *file, int backwards_mode) {
+    struct stat info;
+    unsigned char *copy;
+    void *data;
+    int fd;
+
+    fd = open(file->input_name, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot access input file %s\n", file->input_name);
+        return 0;
+    }
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+        fprintf(stderr, "Error: Cannot access input file %s\n", file->input_name);
+        close(fd);
+        return 0;
+    }
+    if (info.st_size == 0 || info.st_size > INT_MAX) {
+        fprintf(stderr, "Error: Input file %s is empty or too large\n", file->input_name);
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map input file %s\n", file->input_name);
+        return 0;
+    }
+    file->input_data = data;
+    file->mapped_size = info.st_size;
+    file->input_size = (int)info.st_size;
+
+    /* backwards compression takes the data reversed, which needs a copy of its own */
+    if (backwards_mode) {
+        copy = malloc(file->input_size);
+        if (!copy) {
+            fprintf(stderr, "Error: Insufficient memory\n");
+            return 0;
+        }
+        memcpy(copy, data, file->input_size);
+        zx_reverse(copy, copy+file->input_size-1);
+        munmap(data, file->mapped_size);
+        file->input_data = copy;
+        file->mapped_size = 0;
+        file->reversed = 1;
+    }
+    return 1;
+}
+
+static void zx_unmap(zx_FILE *file) {
+    if (file->reversed) {
+        free((void *)file->input_data);
+    } else if (file->mapped_size) {
+        munmap((void *)file->input_data, file->mapped_size);
+    }
+    file->input_data = NULL;
+    file->mapped_size = 0;
+}
+
+static int zx_write(const char *output_name, const unsigned char *output_data, int output_size) {
+    char *temporary;
+    FILE *file;
+    int written;
+
+    temporary = malloc(strlen(output_name)+32);
+    if (!temporary) {
+        return 0;
+    }
+    sprintf(temporary, "%s.tmp%ld", output_name, (long)getpid());
+    file = fopen(temporary, "wb");
+    if (!file) {
+        free(temporary);
+        return 0;
+    }
+    written = fwrite(output_data, 1, output_size, file) == (size_t)output_size;
+    if (fclose(file) || !written || rename(temporary, output_name)) {
+        remove(temporary);
+        written = 0;
+    }
+    free(temporary);
+    return written;
+}
+
+/* called one item at a time, so the output and the report need no locking */
+static void zx_finish(zx_JOB *job, int index, unsigned char *output_data, int output_size, long delta, double seconds) {
+    zx_FILE *file = &job->files[index];
+
+    if (!output_data) {
+        fprintf(stderr, "Error: Cannot compress %s\n", file->input_name);
+        job->failed++;
+        return;
+    }
+    if (job->backwards_mode) {
+        zx_reverse(output_data, output_data+output_size-1);
+    }
+    if (!zx_write(file->output_name, output_data, output_size)) {
+        fprintf(stderr, "Error: Cannot write output file %s\n", file->output_name);
+        job->failed++;
+        return;
+    }
+    job->input_total += file->input_size;
+    job->output_total += output_size;
+    if (job->report) {
+        printf("%s: %d -> %d bytes (%.2f%%), delta %ld, %.3fs\n", file->input_name, file->input_size, output_size,
+               100.0*output_size/file->input_size, delta, seconds);
+    }
+}
+
+static void zx0_done(void *user, zx0_ITEM *item) {
+    zx_JOB *job = user;
+
+    zx_finish(job, (int)(item-job->zx0_items), item->output_data, item->output_size, item->delta, item->seconds);
+}
+
+static void zx7_done(void *user, zx7_ITEM *item) {
+    zx_JOB *job = user;
+
+    zx_finish(job, (int)(item-job->zx7_items), item->output_data, item->output_size, item->delta, item->seconds);
+}
+
+/* one input name per line, blank lines and lines starting with # are skipped */
+static int zx_read_manifest(const char *manifest, char ***names, int *nr_names, int *capacity) {
+    char line[4096];
+    char **grown;
+    FILE *file;
+    size_t length;
+
+    file = fopen(manifest, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot access manifest %s\n", manifest);
+        return 0;
+    }
+    while (fgets(line, sizeof line, file)) {
+        length = strlen(line);
+        while (length && (line[length-1] == '\n' || line[length-1] == '\r')) {
+            line[--length] = 0;
+        }
+        if (!length || line[0] == '#') {
+            continue;
+        }
+        if (*nr_names == *capacity) {
+            *capacity = *capacity ? *capacity*2 : 64;
+            grown = realloc(*names, *capacity * sizeof(char *));
+            if (!grown) {
+                fclose(file);
+                return 0;
+            }
+            *names = grown;
+        }
+        (*names)[*nr_names] = malloc(length+1);
+        if (!(*names)[*nr_names]) {
+            fclose(file);
+            return 0;
+        }
+        strcpy((*names)[(*nr_names)++], line);
+    }
+    fclose(file);
+    return 1;
+}
+
+static char *zx_output_name(const char *input_name, const char *output_dir, const char *extension) {
+    const char *base = input_name;
+    const char *slash;
+    char *output_name;
+
+    if (output_dir) {
+        slash = strrchr(input_name, '/');
+        if (slash) {
+            base = slash+1;
+        }
+        output_name = malloc(strlen(output_dir)+strlen(base)+strlen(extension)+2);
+        if (output_name) {
+            sprintf(output_name, "%s/%s%s", output_dir, base, extension);
+        }
+    } else {
+        output_name = malloc(strlen(input_name)+strlen(extension)+1);
+        if (output_name) {
+            sprintf(output_name, "%s%s", input_name, extension);
+        }
+    }
+    return output_name;
+}
+
+static int zx_output_order(const void *a, const void *b) {
+    return strcmp((*(zx_FILE * const *)a)->output_name, (*(zx_FILE * const *)b)->output_name);
+}
+
+/* two inputs writing the same output (the same name in different directories with -o) would lose one */
+static int zx_unique_outputs(zx_FILE *files, int nr_files) {
+    zx_FILE **order;
+    int unique = 1;
+    int i;
+
+    order = malloc(nr_files*sizeof(zx_FILE *));
+    if (!order) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        return 0;
+    }
+    for (i = 0; i < nr_files; i++) {
+        order[i] = &files[i];
+    }
+    qsort(order, nr_files, sizeof(zx_FILE *), zx_output_order);
+    for (i = 1; i < nr_files && unique; i++) {
+        if (!strcmp(order[i-1]->output_name, order[i]->output_name)) {
+            fprintf(stderr, "Error: Input files %s and %s have the same output file %s\n", order[i-1]->input_name,
+                    order[i]->input_name, order[i]->output_name);
+            unique = 0;
+        }
+    }
+    free(order);
+    return unique;
+}
+
+static void zx_usage(void) {
+    fprintf(stderr, "Usage: zx [options] input...\n"
+                    "  -7          zx7 format instead of zx0\n"
+                    "  -f          overwrite existing output files\n"
+                    "  -c          classic zx0 file format (v1.*)\n"
+                    "  -b          compression backwards\n"
+                    "  -q          quick non-optimal zx0 compression\n"
+                    "  -l level    zx0 compression level 1-9\n"
+                    "  -d lambda   trade size for Z80 decoding speed, giving up lambda bits per T-state saved\n"
+                    "  -s skip     bytes at the start of each input used only as a prefix (at the end backwards)\n"
+                    "  -j jobs     files compressed at the same time\n"
+                    "  -m file     also compress the inputs listed in file, one per line\n"
+                    "  -o dir      write outputs to dir instead of next to each input\n"
+                    "  -C dir      keep compressed outputs in a cache in dir\n"
+                    "  -r          report size, ratio, delta and time of each file\n");
+}
+
+int main(int argc, char *argv[]) {
+    zx_JOB job;
+    zx_FILE *files;
+    zx0_OPTIONS options;
+    zx0_CYCLES zx0_cycles;
+    zx7_CYCLES zx7_cycles;
+    zx0_CACHE *zx0_cache = NULL;
+    zx7_CACHE *zx7_cache = NULL;
+    const char *output_dir = NULL;
+    const char *cache_dir = NULL;
+    char **names = NULL;
+    struct stat info;
+    int nr_names = 0;
+    int capacity = 0;
+    int format = 0;
+    int force = 0;
+    int invert_mode = 1;
+    int skip = 0;
+    int jobs = 1;
+    int nr_files = 0;
+    double start;
+    int i;
+
+    memset(&job, 0, sizeof job);
+    memset(&options, 0, sizeof options);
+    zx0_z80_cycles(&zx0_cycles);
+    zx7_z80_cycles(&zx7_cycles);
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (!strcmp(argv[i], "-7")) {
+            format = 7;
+        } else if (!strcmp(argv[i], "-f")) {
+            force = 1;
+        } else if (!strcmp(argv[i], "-c")) {
+            invert_mode = 0;
+        } else if (!strcmp(argv[i], "-b")) {
+            job.backwards_mode = 1;
+        } else if (!strcmp(argv[i], "-q")) {
+            options.quick = 1;
+        } else if (!strcmp(argv[i], "-r")) {
+            job.report = 1;
+        } else if (i+1 < argc && !strcmp(argv[i], "-l")) {
+            options.level = atoi(argv[++i]);
+            if (options.level < ZX0_MIN_LEVEL || options.level > ZX0_MAX_LEVEL) {
+                fprintf(stderr, "Error: Invalid level %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i+1 < argc && !strcmp(argv[i], "-d")) {
+            options.lambda = atof(argv[++i]);
+            if (options.lambda <= 0) {
+                fprintf(stderr, "Error: Invalid lambda %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i+1 < argc && !strcmp(argv[i], "-s")) {
+            skip = atoi(argv[++i]);
+            if (skip < 0) {
+                fprintf(stderr, "Error: Invalid skip %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i+1 < argc && !strcmp(argv[i], "-j")) {
+            jobs = atoi(argv[++i]);
+            if (jobs < 1) {
+                fprintf(stderr, "Error: Invalid number of jobs %s\n", argv[i]);
+                return 1;
+            }
+        } else if (i+1 < argc && !strcmp(argv[i], "-m")) {
+            if (!zx_read_manifest(argv[++i], &names, &nr_names, &capacity)) {
+                return 1;
+            }
+        } else if (i+1 < argc && !strcmp(argv[i], "-o")) {
+            output_dir = argv[++i];
+        } else if (i+1 < argc && !strcmp(argv[i], "-C")) {
+            cache_dir = argv[++i];
+        } else {
+            zx_usage();
+            return 1;
+        }
+    }
+    if (format == 7 && (!invert_mode || options.quick || options.level)) {
+        fprintf(stderr, "Error: Options -c, -q and -l are only for zx0\n");
+        return 1;
+    }
+
+    files = calloc(nr_names+argc-i+1, sizeof(zx_FILE));
+    if (!files) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        return 1;
+    }
+    for (; i < argc; i++) {
+        files[nr_files++].input_name = argv[i];
+    }
+    for (i = 0; i < nr_names; i++) {
+        files[nr_files++].input_name = names[i];
+    }
+    if (!nr_files) {
+        zx_usage();
+        return 1;
+    }
+    job.files = files;
+    if (options.lambda > 0) {
+        options.cycles = &zx0_cycles;
+    }
+
+    /* check every file before compressing any, so a mistake does not cost a whole run */
+    for (i = 0; i < nr_files; i++) {
+        files[i].output_name = zx_output_name(files[i].input_name, output_dir, format == 7 ? ".zx7" : ".zx0");
+        if (!files[i].output_name) {
+            fprintf(stderr, "Error: Insufficient memory\n");
+            return 1;
+        }
+        if (!force && !stat(files[i].output_name, &info)) {
+            fprintf(stderr, "Error: Already existing output file %s\n", files[i].output_name);
+            return 1;
+        }
+        if (!zx_map(&files[i], job.backwards_mode)) {
+            return 1;
+        }
+        if (skip >= files[i].input_size) {
+            fprintf(stderr, "Error: Skipping entire input file %s\n", files[i].input_name);
+            return 1;
+        }
+    }
+    if (!zx_unique_outputs(files, nr_files)) {
+        return 1;
+    }
+
+    if (cache_dir) {
+        if (format == 7) {
+            zx7_cache = zx7_cache_open(cache_dir);
+        } else {
+            zx0_cache = zx0_cache_open(cache_dir);
+        }
+        if (!zx0_cache && !zx7_cache) {
+            fprintf(stderr, "Error: Cannot open cache %s\n", cache_dir);
+            return 1;
+        }
+    }
+
+    start = zx_seconds();
+    if (format == 7) {
+        job.zx7_items = calloc(nr_files, sizeof(zx7_ITEM));
+        if (!job.zx7_items) {
+            fprintf(stderr, "Error: Insufficient memory\n");
+            return 1;
+        }
+        for (i = 0; i < nr_files; i++) {
+            job.zx7_items[i].input_data = files[i].input_data;
+            job.zx7_items[i].input_size = files[i].input_size;
+            job.zx7_items[i].skip = skip;
+            if (options.lambda > 0) {
+                job.zx7_items[i].cycles = &zx7_cycles;
+                job.zx7_items[i].lambda = options.lambda;
+            }
+        }
+        if (zx7_cache) {
+            zx7_cache_compress_batch(zx7_cache, job.zx7_items, nr_files, jobs, zx7_done, &job);
+        } else {
+            zx7_compress_batch(job.zx7_items, nr_files, jobs, zx7_done, &job);
+        }
+        for (i = 0; i < nr_files; i++) {
+            free(job.zx7_items[i].output_data);
+        }
+        free(job.zx7_items);
+    } else {
+        job.zx0_items = calloc(nr_files, sizeof(zx0_ITEM));
+        if (!job.zx0_items) {
+            fprintf(stderr, "Error: Insufficient memory\n");
+            return 1;
+        }
+        for (i = 0; i < nr_files; i++) {
+            job.zx0_items[i].input_data = files[i].input_data;
+            job.zx0_items[i].input_size = files[i].input_size;
+            job.zx0_items[i].skip = skip;
+            job.zx0_items[i].backwards_mode = job.backwards_mode;
+            job.zx0_items[i].invert_mode = invert_mode;
+            job.zx0_items[i].options = &options;
+        }
+        if (zx0_cache) {
+            zx0_cache_compress_batch(zx0_cache, job.zx0_items, nr_files, jobs, zx0_done, &job);
+        } else {
+            zx0_compress_batch(job.zx0_items, nr_files, jobs, zx0_done, &job);
+        }
+        for (i = 0; i < nr_files; i++) {
+            free(job.zx0_items[i].output_data);
+        }
+        free(job.zx0_items);
+    }
+
+    if (job.report) {
+        printf("%d file%s: %ld -> %ld bytes (%.2f%%), %.3fs\n", nr_files-job.failed, nr_files-job.failed == 1 ? "" : "s",
+               job.input_total, job.output_total, job.input_total ? 100.0*job.output_total/job.input_total : 0.0,
+               zx_seconds()-start);
+    }
+
+    for (i = 0; i < nr_files; i++) {
+        zx_unmap(&files[i]);
+        free(files[i].output_name);
+    }
+    for (i = 0; i < nr_names; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(files);
+    zx0_cache_close(zx0_cache);
+    zx7_cache_close(zx7_cache);
+
+    return job.failed ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The quick estimates are never below the size of the optimal parse, over the full window for zx0.
+ */
+
+#include "../zx0/zx0.h"
+#include "../zx7/zx7.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_SIZE 6144
+
+/* the same numbers on every host, unlike rand() */
+static unsigned next_random(unsigned *state) {
+    *state = *state*1103515245u + 12345u;
+    return *state >> 16;
+}
+
+/* letters of a tiny alphabet */
+static void make_letters(unsigned char *data, int size, unsigned *state) {
+    int i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = (unsigned char)"abcab"[next_random(state) % 5];
+    }
+}
+
+/* mostly blank 8x8 tiles with a few shapes */
+static void make_tiles(unsigned char *data, int size, unsigned *state) {
+    int i;
+
+    memset(data, 0, size);
+    for (i = 0; i < size; i++) {
+        if (i % 8 == 0 && next_random(state) % 4) {
+            i += 7;
+        } else {
+            data[i] = (unsigned char)(next_random(state) % 3 ? 0x18 : next_random(state));
+        }
+    }
+}
+
+/* a block of noise repeated from far back, beyond the windows of the smaller levels */
+static void make_far_repeats(unsigned char *data, int size, unsigned *state) {
+    int i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = i < 2048 ? (unsigned char)next_random(state) : data[i-2048];
+    }
+}
+
+/* noise, which hardly compresses */
+static void make_noise(unsigned char *data, int size, unsigned *state) {
+    int i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = (unsigned char)next_random(state);
+    }
+}
+
+int main(void) {
+    static const struct {
+        const char *name;
+        void (*make)(unsigned char *data, int size, unsigned *state);
+    } kinds[] = {
+        { "letters", make_letters },
+        { "tiles", make_tiles },
+        { "far repeats", make_far_repeats },
+        { "noise", make_noise }
+    };
+    unsigned char *input_data;
+    unsigned char *output_data;
+    unsigned state;
+    int output_size;
+    int estimate;
+    int delta;
+    long zx7_delta;
+    int failed = 0;
+    int i;
+
+    input_data = malloc(INPUT_SIZE);
+    if (!input_data) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        return 1;
+    }
+    for (i = 0; i < (int)(sizeof kinds / sizeof *kinds); i++) {
+        state = 1+i;
+        kinds[i].make(input_data, INPUT_SIZE, &state);
+        output_data = zx0_compress(input_data, INPUT_SIZE, 0, 0, 1, &output_size, &delta, NULL);
+        estimate = zx0_estimate_quick(input_data, INPUT_SIZE, 0, NULL);
+        if (!output_data || estimate < output_size) {
+            fprintf(stderr, "FAILED: zx0 quick estimate %d of %s below its size %d\n", estimate, kinds[i].name, output_size);
+            failed++;
+        }
+        free(output_data);
+        output_data = zx7_compress(input_data, INPUT_SIZE, 0, &output_size, &zx7_delta);
+        estimate = zx7_estimate_quick(input_data, INPUT_SIZE, 0, NULL);
+        if (!output_data || estimate < output_size) {
+            fprintf(stderr, "FAILED: zx7 quick estimate %d of %s below its size %d\n", estimate, kinds[i].name, output_size);
+            failed++;
+        }
+        free(output_data);
+    }
+    free(input_data);
+
+    return failed ? 1 : 0;
+}
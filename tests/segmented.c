@@ -0,0 +1,103 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Segmented compressions of whole inputs where a segment boundary falls on a byte that repeats the offset
+ * of the match before it, decompressed back.
+ */
+
+#include "../zx0/zx0.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_SIZE 40000
+
+/* the same numbers on every host, unlike rand() */
+static unsigned next_random(unsigned *state) {
+    *state = *state*1103515245u + 12345u;
+    return *state >> 16;
+}
+
+/* letters of a tiny alphabet, so nearly every byte repeats a recent offset */
+static void make_letters(unsigned char *data, int size, unsigned seed) {
+    int i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = (unsigned char)"abcab"[next_random(&seed) % 5];
+    }
+}
+
+static int check_segmented(const unsigned char *input_data, int level) {
+    zx0_OPTIONS options;
+    unsigned char *output_data;
+    unsigned char *decompressed = NULL;
+    int output_size;
+    int delta;
+    int size;
+    int ok;
+
+    memset(&options, 0, sizeof options);
+    options.level = level;
+    options.segmented = 1;
+    output_data = zx0_compress_ex(input_data, INPUT_SIZE, 0, 0, 1, &output_size, &delta, NULL, &options);
+    if (output_data) {
+        decompressed = zx0_decompress(output_data, output_size, NULL, 0, 0, 1, &size);
+    }
+    ok = decompressed && size == INPUT_SIZE && !memcmp(decompressed, input_data, size);
+    free(decompressed);
+    free(output_data);
+    return ok;
+}
+
+int main(void) {
+    /* inputs that crashed at each level, a window of 1024, 2048 and 4096 offsets */
+    static const struct {
+        int level;
+        unsigned seed;
+    } cases[] = {
+        { 4, 1 }, { 4, 2 }, { 5, 5 }, { 6, 17 }
+    };
+    unsigned char *input_data;
+    int failed = 0;
+    int i;
+
+    input_data = malloc(INPUT_SIZE);
+    if (!input_data) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        return 1;
+    }
+    for (i = 0; i < (int)(sizeof cases / sizeof *cases); i++) {
+        make_letters(input_data, INPUT_SIZE, cases[i].seed);
+        if (!check_segmented(input_data, cases[i].level)) {
+            fprintf(stderr, "FAILED: segmented letters %u at level %d\n", cases[i].seed, cases[i].level);
+            failed++;
+        }
+    }
+    free(input_data);
+
+    return failed ? 1 : 0;
+}
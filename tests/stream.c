@@ -0,0 +1,121 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Streams of inputs where a segment boundary falls on a byte that repeats the offset of the match before it,
+ * fed a piece at a time and decompressed back.
+ */
+
+#include "../zx0/zx0.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_SIZE 40000
+#define PIECE_SIZE 777
+
+typedef struct output_t {
+    unsigned char *data;
+    int size;
+} OUTPUT;
+
+/* the same numbers on every host, unlike rand() */
+static unsigned next_random(unsigned *state) {
+    *state = *state*1103515245u + 12345u;
+    return *state >> 16;
+}
+
+/* letters of a tiny alphabet, so nearly every byte repeats a recent offset */
+static void make_letters(unsigned char *data, int size, unsigned seed) {
+    int i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = (unsigned char)"abcab"[next_random(&seed) % 5];
+    }
+}
+
+static void write_output(void *user, const unsigned char *output_data, int output_size) {
+    OUTPUT *output = user;
+
+    memcpy(output->data+output->size, output_data, output_size);
+    output->size += output_size;
+}
+
+static int check_stream(const unsigned char *input_data, int window, int threads) {
+    zx0_OPTIONS options;
+    zx0_STREAM *stream;
+    OUTPUT output;
+    unsigned char *decompressed;
+    int delta;
+    int size;
+    int i;
+    int ok;
+
+    memset(&options, 0, sizeof options);
+    options.window = window;
+    options.threads = threads;
+    output.data = malloc(INPUT_SIZE*2);
+    output.size = 0;
+    stream = zx0_stream_create(0, 1, &options, write_output, &output);
+    if (!output.data || !stream) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    ok = 1;
+    for (i = 0; i < INPUT_SIZE && ok; i += PIECE_SIZE) {
+        ok = zx0_stream_feed(stream, input_data+i, INPUT_SIZE-i < PIECE_SIZE ? INPUT_SIZE-i : PIECE_SIZE);
+    }
+    ok = ok && zx0_stream_flush(stream, &delta);
+    zx0_stream_free(stream);
+    decompressed = ok ? zx0_decompress(output.data, output.size, NULL, 0, 0, 1, &size) : NULL;
+    ok = decompressed && size == INPUT_SIZE && !memcmp(decompressed, input_data, size);
+    free(decompressed);
+    free(output.data);
+    return ok;
+}
+
+int main(void) {
+    unsigned char *input_data;
+    unsigned seed;
+    int failed = 0;
+
+    input_data = malloc(INPUT_SIZE);
+    if (!input_data) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        return 1;
+    }
+    /* the odd seeds on one thread and the even ones on two */
+    for (seed = 1; seed <= 4; seed++) {
+        make_letters(input_data, INPUT_SIZE, seed);
+        if (!check_stream(input_data, 1024, 2-seed%2)) {
+            fprintf(stderr, "FAILED: stream of letters %u on %u threads\n", seed, 2-seed%2);
+            failed++;
+        }
+    }
+    free(input_data);
+
+    return failed ? 1 : 0;
+}
@@ -23,26 +23,59 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "zx0.h"
+#include "internal.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#ifndef ZX0_NO_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* vectorized match masks on x86-64, where SSE2 is always there and AVX2 is picked at runtime */
+#if !defined(ZX0_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define ZX0_SIMD
+#include <immintrin.h>
+#endif
 
 #define MAX_SCALE 10
 #define INITIAL_OFFSET 1
-#define ZX0_MAX_OFFSET 32640
-#define MAX_ALLOCS 10000
+#define THREAD_OFFSETS 2048    /* fewest offsets a thread sweeps to be worth two barriers per index */
 
 typedef struct zx0_block_t {
     struct zx0_block_t *chain;
     struct zx0_block_t *ghost_chain;
-    int bits;
+    int bits;                   /* cost of the parse up to index, in bits unless a cost model weighs in cycles */
     int index;
     int offset;
     int references;
 } zx0_BLOCK;
 
+typedef struct zx0_slab_t {
+    struct zx0_slab_t *next;
+    size_t size;
+    size_t used;
+    zx0_BLOCK blocks[];
+} zx0_SLAB;
+
+/* blocks are carved from slabs that double in size, and recycled through ghost_root */
+typedef struct zx0_pool_t {
+    zx0_SLAB *slabs;
+    zx0_BLOCK *ghost_root;
+    size_t bytes;
+    size_t high_water;
+    long allocated;
+    long recycled;
+    int shared;
+} zx0_POOL;
+
 static int offset_ceiling(int index, int offset_limit) {
     return index > offset_limit ? offset_limit : index < INITIAL_OFFSET ? INITIAL_OFFSET : index;
 }
@@ -54,124 +87,1097 @@ static int elias_gamma_bits(int value) {
     return bits;
 }
 
+/*
+ * Costs of the tokens, as multiples of a bit and decode cycles weighed together. Without a lambda
+ * these are the bits themselves; with one they are COST_SCALE per bit plus COST_SCALE*lambda per
+ * cycle, rounded, so a lambda finer than 1/COST_SCALE bits per cycle makes no difference.
+ */
+typedef struct zx0_cost_t {
+    int bit;
+    int literal;                /* literal run indicator */
+    int literal_byte;
+    int repeat;                 /* repeat indicator */
+    int new_offset;             /* new offset indicator and offset LSB */
+    int copy_byte;              /* per byte of either copy */
+    int gamma_bit;
+} zx0_COST;
+
+#define COST_SCALE 32
+
+static int zx0_weighted(const zx0_OPTIONS *settings) {
+    return settings && settings->cycles && settings->lambda > 0;
+}
+
+/* fill cost for settings, returns 0 when the costs of input_size bytes could overflow an int */
+static int zx0_cost_model(const zx0_OPTIONS *settings, int input_size, zx0_COST *cost) {
+    const zx0_CYCLES *c = settings->cycles;
+    long long rate;
+    int scale = 1;
+    int weight = 0;
+
+    if (zx0_weighted(settings)) {
+        scale = COST_SCALE;
+        weight = (int)(settings->lambda*COST_SCALE + 0.5);
+    }
+    cost->bit = scale;
+    cost->literal = scale + (weight ? weight*c->literal : 0);
+    cost->literal_byte = 8*scale + (weight ? weight*c->literal_byte : 0);
+    cost->repeat = scale + (weight ? weight*c->repeat : 0);
+    cost->new_offset = 8*scale + (weight ? weight*c->new_offset : 0);
+    cost->copy_byte = weight ? weight*c->copy_byte : 0;
+    cost->gamma_bit = scale + (weight ? weight*c->gamma_bit : 0);
+    if (!weight)
+        return 1;
+
+    /* a chain of a single offset alternates literals and repeats, anything else pays less per byte than that */
+    rate = (long long)cost->literal + cost->repeat + 2LL*cost->gamma_bit + cost->literal_byte + cost->copy_byte;
+    return rate*(input_size+1) + cost->new_offset + 64LL*cost->gamma_bit < INT_MAX/2;
+}
+
+static double zx0_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
 #define QTY_BLOCKS 10000
+#define MAX_QTY_BLOCKS (QTY_BLOCKS << 10)
 
-#define zx0_allocate(output, a, b, c, d) \
-do \
-{ \
-    zx0_BLOCK *next = d; \
-    zx0_BLOCK *ptr; \
-    if (ghost_root) { \
-        ptr = ghost_root; \
-        ghost_root = ptr->ghost_chain; \
-        if (ptr->chain && !--ptr->chain->references) { \
-            ptr->chain->ghost_chain = ghost_root; \
-            ghost_root = ptr->chain; \
-        } \
-    } else { \
-        if (!dead_array_size) { \
-            if ((*nr_allocs) == MAX_ALLOCS) { \
-                output = NULL; \
-                break; \
-            } \
-            dead_array = malloc(QTY_BLOCKS * sizeof(zx0_BLOCK)); \
-            if (dead_array == NULL) { \
-                output = NULL; \
-                break; \
-            } \
-            allocated_mem[(*nr_allocs)] = dead_array; \
-            (*nr_allocs)++; \
-            dead_array_size = QTY_BLOCKS; \
-        } \
-        ptr = &dead_array[--dead_array_size]; \
-    } \
-    ptr->bits = a; \
-    ptr->index = b; \
-    ptr->offset = c; \
-    if (next) \
-        next->references++; \
-    ptr->chain = next; \
-    ptr->references = 0; \
-    output = ptr; \
-} while (0)
+/* blocks are only shared between threads when the sweep is split */
+static void zx0_reference(zx0_BLOCK *block, int shared) {
+    if (shared)
+        __atomic_add_fetch(&block->references, 1, __ATOMIC_RELAXED);
+    else
+        block->references++;
+}
+
+static int zx0_unreference(zx0_BLOCK *block, int shared) {
+    if (shared)
+        return __atomic_sub_fetch(&block->references, 1, __ATOMIC_ACQ_REL);
+    return --block->references;
+}
+
+static zx0_SLAB *zx0_pool_grow(zx0_POOL *pool) {
+    size_t size = pool->slabs ? pool->slabs->size*2 : QTY_BLOCKS;
+    zx0_SLAB *slab;
+
+    if (size > MAX_QTY_BLOCKS)
+        size = MAX_QTY_BLOCKS;
+    slab = malloc(sizeof(zx0_SLAB) + size * sizeof(zx0_BLOCK));
+    if (slab == NULL) {
+        return NULL;
+    }
+    slab->next = pool->slabs;
+    slab->size = size;
+    slab->used = 0;
+    pool->slabs = slab;
+    pool->bytes += sizeof(zx0_SLAB) + size * sizeof(zx0_BLOCK);
+    if (pool->high_water < pool->bytes)
+        pool->high_water = pool->bytes;
+    return slab;
+}
+
+/* forget every block, keeping only the largest slab for the next run */
+static void zx0_pool_reset(zx0_POOL *pool) {
+    zx0_SLAB *slab = pool->slabs;
+    zx0_SLAB *next;
+
+    pool->ghost_root = NULL;
+    pool->bytes = 0;
+    pool->allocated = 0;
+    pool->recycled = 0;
+    if (!slab) {
+        return;
+    }
+    for (next = slab->next; next; next = slab->next) {
+        slab->next = next->next;
+        free(next);
+    }
+    slab->used = 0;
+    pool->bytes = sizeof(zx0_SLAB) + slab->size * sizeof(zx0_BLOCK);
+}
+
+static void zx0_pool_free(zx0_POOL *pool) {
+    zx0_SLAB *next;
 
-static void zx0_assign(zx0_BLOCK **ptr, zx0_BLOCK *chain, zx0_BLOCK **ghost_root) {
-    chain->references++;
-    if (*ptr && !--(*ptr)->references) {
-        (*ptr)->ghost_chain = *ghost_root;
-        *ghost_root = *ptr;
+    while (pool->slabs) {
+        next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
     }
+    pool->ghost_root = NULL;
+    pool->bytes = 0;
+}
+
+/* one pool per sweep thread, so blocks are allocated without locking */
+struct zx0_arena_t {
+    zx0_POOL pools[ZX0_MAX_THREADS];
+};
+
+zx0_ARENA *zx0_arena_create(void) {
+    return calloc(1, sizeof(zx0_ARENA));
+}
+
+void zx0_arena_reset(zx0_ARENA *arena) {
+    int i;
+
+    for (i = 0; i < ZX0_MAX_THREADS; i++)
+        zx0_pool_reset(&arena->pools[i]);
+}
+
+size_t zx0_arena_high_water(const zx0_ARENA *arena) {
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < ZX0_MAX_THREADS; i++)
+        bytes += arena->pools[i].high_water;
+    return bytes;
+}
+
+void zx0_arena_free(zx0_ARENA *arena) {
+    int i;
+
+    if (!arena)
+        return;
+    for (i = 0; i < ZX0_MAX_THREADS; i++)
+        zx0_pool_free(&arena->pools[i]);
+    free(arena);
+}
+
+static zx0_BLOCK *zx0_allocate(zx0_POOL *pool, int bits, int index, int offset, zx0_BLOCK *chain) {
+    zx0_SLAB *slab = pool->slabs;
+    zx0_BLOCK *ptr;
+
+    if (pool->ghost_root) {
+        ptr = pool->ghost_root;
+        pool->ghost_root = ptr->ghost_chain;
+        pool->recycled++;
+        if (ptr->chain && !zx0_unreference(ptr->chain, pool->shared)) {
+            ptr->chain->ghost_chain = pool->ghost_root;
+            pool->ghost_root = ptr->chain;
+        }
+    } else {
+        if (!slab || slab->used == slab->size) {
+            slab = zx0_pool_grow(pool);
+            if (!slab) {
+                return NULL;
+            }
+        }
+        ptr = &slab->blocks[slab->used++];
+        pool->allocated++;
+    }
+    ptr->bits = bits;
+    ptr->index = index;
+    ptr->offset = offset;
+    if (chain)
+        zx0_reference(chain, pool->shared);
+    ptr->chain = chain;
+    ptr->ghost_chain = NULL;
+    ptr->references = 0;
+    return ptr;
+}
+
+static void zx0_release(zx0_BLOCK *block, zx0_POOL *pool) {
+    if (block && !zx0_unreference(block, pool->shared)) {
+        block->ghost_chain = pool->ghost_root;
+        pool->ghost_root = block;
+    }
+}
+
+static void zx0_assign(zx0_BLOCK **ptr, zx0_BLOCK *chain, zx0_POOL *pool) {
+    zx0_reference(chain, pool->shared);
+    zx0_release(*ptr, pool);
     *ptr = chain;
 }
 
-static zx0_BLOCK *zx0_optimize(const unsigned char *input_data, int input_size, int skip, int offset_limit, void (*progress)(int), void *allocated_mem[MAX_ALLOCS], size_t *nr_allocs)
-{
-    zx0_BLOCK **last_literal;
-    zx0_BLOCK **last_match;
-    int *match_length;
-    int best_length_size;
-    int bits;
+typedef struct zx0_barrier_t {
+    int count;
+    int waiting;
+    int generation;
+} zx0_BARRIER;
+
+/*
+ * Everything the sweep needs per offset, with the bits and index of the last blocks cached inline.
+ * The literal block is only allocated once something links to it, until then it is described by
+ * last_literal_bits and last_literal_index and would chain to last_match.
+ */
+typedef struct zx0_offset_t {
+    zx0_BLOCK *last_literal;
+    zx0_BLOCK *last_match;
+    int last_literal_bits;
+    int last_literal_index;
+    int last_match_bits;
+    int last_match_index;
+    int match_length;
+} zx0_OFFSET;
+
+/*
+ * Bit j of the mask stands for offset o+31-j of the 32 offsets starting at o. It is set when the byte
+ * at that offset matches the current one, when the offset is active (inside a match or holding a literal
+ * block), or when its literal floor is below the limit and a literal there might beat the best block.
+ */
+typedef unsigned int (*zx0_MASK_KERNEL)(const unsigned char *data, const unsigned char *active, const int *floor, unsigned char value, int limit);
+
+typedef struct zx0_sweep_t {
+    const unsigned char *input_data;
+    int first_match;            /* first index a match may end at */
     int index;
-    int offset;
+    int stop;
+    zx0_OFFSET *offsets;
+    unsigned char *active;      /* indexed by ZX0_MAX_OFFSET-offset, so they run parallel to the input */
+    int *floor;                 /* cheapest literal after last_match less its bytes, INT_MAX without a match */
+    zx0_MASK_KERNEL mask_kernel;
+    zx0_COST cost;
+    zx0_BLOCK **optimal;
+    zx0_BARRIER start;
+    zx0_BARRIER done;
+} zx0_SWEEP;
+
+typedef struct zx0_worker_t {
+    zx0_SWEEP *sweep;
+    zx0_POOL *pool;
+    int *best_length;
+    zx0_BLOCK *best;
+    int first_offset;
+    int last_offset;
+    int failed;
+#ifndef ZX0_NO_THREADS
+    pthread_t thread;
+#endif
+} zx0_WORKER;
+
+static int zx0_literal_block(zx0_OFFSET *o, zx0_POOL *pool) {
+    if (!o->last_literal) {
+        o->last_literal = zx0_allocate(pool, o->last_literal_bits, o->last_literal_index, 0, o->last_match);
+        if (!o->last_literal) {
+            return 0;
+        }
+        zx0_reference(o->last_literal, pool->shared);
+    }
+    return 1;
+}
+
+static void zx0_set_last_match(zx0_OFFSET *o, zx0_BLOCK *chain, zx0_POOL *pool) {
+    zx0_assign(&o->last_match, chain, pool);
+    o->last_match_bits = chain->bits;
+    o->last_match_index = chain->index;
+}
+
+#ifndef ZX0_SIMD
+static unsigned int zx0_mask_scalar(const unsigned char *data, const unsigned char *active, const int *floor, unsigned char value, int limit) {
+    unsigned int mask = 0;
+    int j;
+
+    for (j = 0; j < 32; j++) {
+        mask |= (unsigned int)((data[j] == value) | (active[j] != 0) | (floor[j] < limit)) << j;
+    }
+    return mask;
+}
+#else
+static unsigned int zx0_mask_sse2(const unsigned char *data, const unsigned char *active, const int *floor, unsigned char value, int limit) {
+    __m128i v = _mm_set1_epi8((char)value);
+    __m128i zero = _mm_setzero_si128();
+    __m128i l = _mm_set1_epi32(limit);
+    unsigned int equal;
+    unsigned int idle;
+    unsigned int below = 0;
+    int j;
+
+    equal = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)data), v)) |
+            (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data+16)), v)) << 16;
+    idle = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)active), zero)) |
+           (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(active+16)), zero)) << 16;
+    for (j = 0; j < 32; j += 4) {
+        below |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(_mm_loadu_si128((const __m128i *)(floor+j)), l))) << j;
+    }
+    return equal | ~idle | below;
+}
+
+__attribute__((target("avx2")))
+static unsigned int zx0_mask_avx2(const unsigned char *data, const unsigned char *active, const int *floor, unsigned char value, int limit) {
+    __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)data), _mm256_set1_epi8((char)value));
+    __m256i idle = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)active), _mm256_setzero_si256());
+    __m256i l = _mm256_set1_epi32(limit);
+    unsigned int below = 0;
+    int j;
+
+    for (j = 0; j < 32; j += 8) {
+        below |= (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(l, _mm256_loadu_si256((const __m256i *)(floor+j))))) << j;
+    }
+    return (unsigned int)_mm256_movemask_epi8(equal) | ~(unsigned int)_mm256_movemask_epi8(idle) | below;
+}
+#endif
+
+static zx0_MASK_KERNEL zx0_mask_kernel(void) {
+#ifdef ZX0_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return zx0_mask_avx2;
+    return zx0_mask_sse2;
+#else
+    return zx0_mask_scalar;
+#endif
+}
+
+/* update the state of a single offset, equal tells whether its byte matches the current one */
+static inline int zx0_sweep_offset(zx0_SWEEP *s, zx0_WORKER *w, zx0_OFFSET *o, int offset, int equal,
+                                   int *best_length_size, int *best_bits, zx0_BLOCK **best) {
+    zx0_BLOCK **optimal = s->optimal;
+    int *best_length = w->best_length;
+    zx0_POOL *pool = w->pool;
+    const zx0_COST *cost = &s->cost;
+    int index = s->index;
     int length;
+    int bits;
     int bits2;
+    zx0_BLOCK *chain;
+
+    if (equal) {
+        /* a skipped mismatch left no literal behind, so rebuild the one ending just before this match */
+        if (!o->match_length && o->last_match && !o->last_literal && o->last_match_index < index-1) {
+            length = index-1-o->last_match_index;
+            o->last_literal_bits = o->last_match_bits + cost->literal + cost->gamma_bit*elias_gamma_bits(length) + length*cost->literal_byte;
+            o->last_literal_index = index-1;
+        }
+        /* copy from last offset */
+        if (o->last_literal_index >= 0) {
+            if (!zx0_literal_block(o, pool)) {
+                return 0;
+            }
+            length = index-o->last_literal_index;
+            bits = o->last_literal_bits + cost->repeat + cost->gamma_bit*elias_gamma_bits(length) + length*cost->copy_byte;
+            chain = zx0_allocate(pool, bits, index, offset, o->last_literal);
+            if (!chain) {
+                return 0;
+            }
+            zx0_set_last_match(o, chain, pool);
+            if (*best_bits > bits) {
+                zx0_assign(best, chain, pool);
+                *best_bits = bits;
+            }
+        }
+        /* copy from new offset */
+        if (++o->match_length > 1) {
+            if (*best_length_size < o->match_length) {
+                length = best_length[*best_length_size];
+                bits = optimal[index-length]->bits + cost->gamma_bit*elias_gamma_bits(length-1) + length*cost->copy_byte;
+                do {
+                    (*best_length_size)++;
+                    bits2 = optimal[index-*best_length_size]->bits + cost->gamma_bit*elias_gamma_bits(*best_length_size-1) + *best_length_size*cost->copy_byte;
+                    if (bits2 <= bits) {
+                        best_length[*best_length_size] = *best_length_size;
+                        bits = bits2;
+                    } else {
+                        best_length[*best_length_size] = best_length[*best_length_size-1];
+                    }
+                } while(*best_length_size < o->match_length);
+            }
+            length = best_length[o->match_length];
+            bits = optimal[index-length]->bits + cost->new_offset + cost->gamma_bit*(elias_gamma_bits((offset-1)/128+1) + elias_gamma_bits(length-1)) + length*cost->copy_byte;
+            if (!o->last_match || o->last_match_index != index || o->last_match_bits > bits) {
+                chain = zx0_allocate(pool, bits, index, offset, optimal[index-length]);
+                if (!chain) {
+                    return 0;
+                }
+                zx0_set_last_match(o, chain, pool);
+                if (*best_bits > bits) {
+                    zx0_assign(best, chain, pool);
+                    *best_bits = bits;
+                }
+            }
+        }
+        /* a resumed parse opens right after its match, and the literal that may follow it is the only block
+           ending at its first byte when that byte repeats the offset */
+        if (index == s->first_match && o->last_match && o->last_match_index == index-1 && !o->last_literal) {
+            o->last_literal_bits = o->last_match_bits + cost->literal + cost->gamma_bit + cost->literal_byte;
+            o->last_literal_index = index;
+            if (!zx0_literal_block(o, pool)) {
+                return 0;
+            }
+            if (*best_bits > o->last_literal_bits) {
+                zx0_assign(best, o->last_literal, pool);
+                *best_bits = o->last_literal_bits;
+            }
+        }
+    } else {
+        /* copy literals */
+        o->match_length = 0;
+        if (o->last_match) {
+            length = index-o->last_match_index;
+            bits = o->last_match_bits + cost->literal + cost->gamma_bit*elias_gamma_bits(length) + length*cost->literal_byte;
+            if (o->last_literal) {
+                zx0_release(o->last_literal, pool);
+                o->last_literal = NULL;
+            }
+            o->last_literal_bits = bits;
+            o->last_literal_index = index;
+            if (*best_bits > bits) {
+                if (!zx0_literal_block(o, pool)) {
+                    return 0;
+                }
+                zx0_assign(best, o->last_literal, pool);
+                *best_bits = bits;
+            }
+        }
+    }
+
+    s->active[ZX0_MAX_OFFSET-offset] = o->match_length || o->last_literal;
+    if (o->last_match) {
+        s->floor[ZX0_MAX_OFFSET-offset] = o->last_match_bits + cost->literal + cost->gamma_bit - o->last_match_index*cost->literal_byte;
+    }
+
+    return 1;
+}
+
+/*
+ * Process offsets first..last of the current index, keeping the cheapest block in *best.
+ *
+ * A literal costs at least its floor plus the cost of its bytes, so an idle offset whose floor cannot beat
+ * the best block so far has nothing to do on a mismatch: its match length is already zero and the
+ * literal it would record is rebuilt when its next match starts. The mask kernel sorts out the offsets
+ * that still need work, 32 at a time.
+ */
+static int zx0_sweep(zx0_SWEEP *s, zx0_WORKER *w, zx0_BLOCK **best) {
+    const unsigned char *input_data = s->input_data;
+    int index = s->index;
+    int best_length_size = 2;
+    int best_bits = *best ? (*best)->bits : INT_MAX;
+    int offset = w->first_offset;
+    unsigned int mask;
+    int j;
+
+    if (index >= s->first_match) {
+        for (; offset+31 <= w->last_offset; offset += 32) {
+            mask = s->mask_kernel(input_data+index-offset-31, s->active+ZX0_MAX_OFFSET-offset-31,
+                                  s->floor+ZX0_MAX_OFFSET-offset-31, input_data[index],
+                                  best_bits == INT_MAX ? INT_MAX : best_bits-index*s->cost.literal_byte);
+            while (mask) {
+                j = 31-__builtin_clz(mask);
+                mask &= ~(1u << j);
+                if (!zx0_sweep_offset(s, w, &s->offsets[offset+31-j], offset+31-j,
+                                      input_data[index] == input_data[index-(offset+31-j)],
+                                      &best_length_size, &best_bits, best)) {
+                    return 0;
+                }
+            }
+        }
+    }
+    for (; offset <= w->last_offset; offset++) {
+        if (!zx0_sweep_offset(s, w, &s->offsets[offset], offset,
+                              index >= s->first_match && index >= offset && input_data[index] == input_data[index-offset],
+                              &best_length_size, &best_bits, best)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+#ifndef ZX0_NO_THREADS
+
+/* spinning barrier, one round trip per index is too frequent for a sleeping one */
+static void zx0_barrier_wait(zx0_BARRIER *barrier) {
+    int generation = __atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE);
+    int spins = 0;
+
+    if (__atomic_add_fetch(&barrier->waiting, 1, __ATOMIC_ACQ_REL) == __atomic_load_n(&barrier->count, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&barrier->waiting, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&barrier->generation, generation+1, __ATOMIC_RELEASE);
+        return;
+    }
+    while (__atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE) == generation) {
+        if (++spins > 1000) {
+            sched_yield();
+        }
+    }
+}
+
+static void *zx0_worker_main(void *arg) {
+    zx0_WORKER *w = arg;
+    zx0_SWEEP *s = w->sweep;
+
+    for (;;) {
+        zx0_barrier_wait(&s->start);
+        if (__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (!w->failed && !zx0_sweep(s, w, &w->best)) {
+            w->failed = 1;
+        }
+        zx0_barrier_wait(&s->done);
+    }
+
+    return NULL;
+}
+
+static void zx0_stop_workers(zx0_SWEEP *s, zx0_WORKER *workers, int nr_workers) {
+    int i;
+
+    if (nr_workers < 2) {
+        return;
+    }
+    __atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+    zx0_barrier_wait(&s->start);
+    for (i = 1; i < nr_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+}
+
+#endif
+
+/* everything a compression needs besides the output, sized for the largest input so far */
+struct zx0_context_t {
+    zx0_ARENA *arena;
+    zx0_OFFSET *offsets;
+    unsigned char *active;
+    int *floor;
+    zx0_BLOCK **optimal;
+    int *best_length[ZX0_MAX_THREADS];
+    int capacity;
+    zx0_WORKER workers[ZX0_MAX_THREADS];
+    int *head;
+    int *prev;
+};
+
+zx0_CONTEXT *zx0_context_create(void) {
+    zx0_CONTEXT *context;
+
+    context = calloc(1, sizeof(zx0_CONTEXT));
+    if (!context)
+        return NULL;
+    context->arena = zx0_arena_create();
+    if (!context->arena) {
+        free(context);
+        return NULL;
+    }
+    return context;
+}
+
+void zx0_context_free(zx0_CONTEXT *context) {
+    int i;
+
+    if (!context)
+        return;
+    zx0_arena_free(context->arena);
+    free(context->offsets);
+    free(context->active);
+    free(context->floor);
+    free(context->optimal);
+    for (i = 0; i < ZX0_MAX_THREADS; i++)
+        free(context->best_length[i]);
+    free(context->head);
+    free(context->prev);
+    free(context);
+}
+
+/* make room for an input of input_size bytes swept by threads threads */
+static int zx0_context_reserve(zx0_CONTEXT *context, int input_size, int threads) {
+    int i;
+
+    if (!context->offsets) {
+        context->offsets = malloc((ZX0_MAX_OFFSET+1)*sizeof(zx0_OFFSET));
+        context->active = malloc((ZX0_MAX_OFFSET+1)*sizeof(unsigned char));
+        context->floor = malloc((ZX0_MAX_OFFSET+1)*sizeof(int));
+        if (!context->offsets || !context->active || !context->floor)
+            return 0;
+    }
+    if (context->capacity < input_size) {
+        free(context->optimal);
+        for (i = 0; i < ZX0_MAX_THREADS; i++) {
+            free(context->best_length[i]);
+            context->best_length[i] = NULL;
+        }
+        context->capacity = 0;
+        context->optimal = malloc(input_size*sizeof(zx0_BLOCK *));
+        if (!context->optimal)
+            return 0;
+        context->capacity = input_size;
+    }
+    for (i = 0; i < threads; i++) {
+        if (!context->best_length[i]) {
+            context->best_length[i] = malloc(context->capacity*sizeof(int));
+            if (!context->best_length[i])
+                return 0;
+        }
+    }
+    return 1;
+}
+
+#define CEILING_CHECK 4096
+#define CEILING_REACH 65536
+
+/*
+ * Whether every parse of the whole input is sure to take more than ceiling bytes. Past index, each one
+ * has a block ending there, a literal run across it, or a match across it: the first costs at least
+ * optimal[index], the second its literals on top of the block before them, and the third the block
+ * before it, which is at most the longest match run of any offset back. A parse costs bits and 18 more
+ * for the end marker.
+ */
+static int zx0_beyond_ceiling(zx0_SWEEP *s, int skip, int index, int max_offset, int literal_floor, int ceiling) {
+    zx0_BLOCK **optimal = s->optimal;
+    int bound = optimal[index]->bits;
+    int run = 0;
+    int i;
+
+    if (literal_floor + (index+1)*8 < bound)
+        bound = literal_floor + (index+1)*8;
+    for (i = 1; i <= max_offset; i++) {
+        if (run < s->offsets[i].match_length)
+            run = s->offsets[i].match_length;
+    }
+    /* a run that long makes the bound too costly to find, and likely too low to matter */
+    if (run > CEILING_REACH || index-run < skip)
+        return 0;
+    for (i = index-run; i < index; i++) {
+        if (bound > optimal[i]->bits)
+            bound = optimal[i]->bits;
+    }
+    return (bound+25)/8 > ceiling;
+}
+
+/*
+ * Find the cheapest parse of input_data[skip..] over the window and threads of settings. A parse that resumes
+ * a stream starts right after a match at last_offset ending at skip-1, so it may open with a match; otherwise
+ * its first byte is a literal. Once the time or work limit of settings runs out, the sweep stops at the
+ * index it stores in *stop_index (input_size if it got through) and returns the best block ending before it.
+ * Once sure to take more bytes than the ceiling of settings it stores the index too, but returns NULL.
+ */
+static zx0_BLOCK *zx0_optimize(zx0_CONTEXT *context, zx0_POOL *pools, const unsigned char *input_data, int input_size, int skip, const zx0_OPTIONS *settings, int resume, int last_offset, void (*progress)(int), int *stop_index)
+{
+    int offset_limit = settings->window;
+    int threads = settings->threads;
+    const int *ceiling = settings->ceiling;
+    int literal_floor;
+    double deadline = settings->time_limit > 0 ? zx0_seconds() + settings->time_limit : 0;
+    long work = 0;
+    zx0_SWEEP sweep;
+    zx0_WORKER *workers = context->workers;
+    zx0_POOL *pool = &pools[0];
+    int nr_workers = 1;
+    int index;
     int dots = 2;
     int max_offset;
+    int i;
     zx0_BLOCK **optimal = NULL;
-    int *best_length = NULL;
     zx0_BLOCK *chain;
-    zx0_BLOCK *ghost_root;
-    zx0_BLOCK *dead_array;
-    int dead_array_size;
+    zx0_BLOCK *result = NULL;
+#ifndef ZX0_NO_THREADS
+    int started = 0;
+#endif
 
-    ghost_root = NULL;
-    dead_array = NULL;
-    dead_array_size = 0;
+    if (threads < 1)
+        threads = 1;
+    if (threads > ZX0_MAX_THREADS)
+        threads = ZX0_MAX_THREADS;
+#ifdef ZX0_NO_THREADS
+    threads = 1;
+#endif
+    /* no more threads than the widest index has offsets for, so small inputs and windows stay serial */
+    max_offset = offset_ceiling(input_size-1, offset_limit);
+    if (threads > max_offset/THREAD_OFFSETS)
+        threads = max_offset < 2*THREAD_OFFSETS ? 1 : max_offset/THREAD_OFFSETS;
 
-    last_literal = calloc(ZX0_MAX_OFFSET+1, sizeof(zx0_BLOCK *));
-    if (last_literal == NULL)
+    memset(&sweep, 0, sizeof sweep);
+    sweep.input_data = input_data;
+    sweep.first_match = resume ? skip : skip+1;
+    if (!zx0_cost_model(settings, input_size, &sweep.cost))
     {
         goto fail;
     }
-    allocated_mem[(*nr_allocs)] = last_literal;
-    (*nr_allocs)++;
 
-    last_match = calloc(ZX0_MAX_OFFSET+1, sizeof(zx0_BLOCK *));
-    if (last_match == NULL)
+    sweep.mask_kernel = zx0_mask_kernel();
+    memset(workers, 0, threads*sizeof(zx0_WORKER));
+    if (!zx0_context_reserve(context, input_size, threads))
     {
         goto fail;
     }
-    allocated_mem[(*nr_allocs)] = last_match;
-    (*nr_allocs)++;
+    sweep.offsets = context->offsets;
+    sweep.active = context->active;
+    sweep.floor = context->floor;
+    optimal = context->optimal;
+    sweep.optimal = optimal;
+    memset(optimal, 0, input_size*sizeof(zx0_BLOCK *));
 
-    match_length = calloc(ZX0_MAX_OFFSET+1, sizeof(int));
-    if (match_length == NULL)
+    /* only offsets up to the last ceiling are ever looked at */
+    max_offset = offset_ceiling(input_size-1, offset_limit);
+    memset(sweep.offsets, 0, (max_offset+1)*sizeof(zx0_OFFSET));
+    memset(sweep.active+ZX0_MAX_OFFSET-max_offset, 0, max_offset+1);
+    for (i = 0; i <= max_offset; i++)
+    {
+        sweep.offsets[i].last_literal_index = -1;
+        sweep.floor[ZX0_MAX_OFFSET-i] = INT_MAX;
+    }
+
+    /* each worker extends its own copy of the best lengths */
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].sweep = &sweep;
+        workers[i].pool = &pools[i];
+        workers[i].pool->shared = threads > 1;
+        workers[i].best_length = context->best_length[i];
+        if (input_size > 2)
+        {
+            workers[i].best_length[2] = 2;
+        }
+    }
+
+    if (progress)
     {
+        progress(1);
+    }
+
+    /* start with fake block, standing for the match before a resumed parse */
+    if (!resume)
+        last_offset = INITIAL_OFFSET;
+    chain = zx0_allocate(pool, resume ? 0 : -sweep.cost.bit, skip-1, last_offset, NULL);
+    if (!chain) {
         goto fail;
     }
-    allocated_mem[(*nr_allocs)] = match_length;
-    (*nr_allocs)++;
+    zx0_set_last_match(&sweep.offsets[last_offset], chain, pool);
+    sweep.floor[ZX0_MAX_OFFSET-last_offset] = chain->bits + sweep.cost.literal + sweep.cost.gamma_bit - chain->index*sweep.cost.literal_byte;
+    if (resume)
+        zx0_assign(&optimal[skip-1], chain, pool);
+    /* the cheapest block a literal run could follow, less 8 bits per byte up to it; costs are bits unweighted */
+    literal_floor = chain->bits - skip*8;
+    if (sweep.cost.bit != 1)
+        ceiling = NULL;
+
+#ifndef ZX0_NO_THREADS
+    if (threads > 1)
+    {
+        sweep.start.count = threads;
+        sweep.done.count = threads;
+        for (; nr_workers < threads; nr_workers++)
+        {
+            if (pthread_create(&workers[nr_workers].thread, NULL, zx0_worker_main, &workers[nr_workers]))
+            {
+                break;
+            }
+        }
+        /* run with whatever threads could be started */
+        __atomic_store_n(&sweep.start.count, nr_workers, __ATOMIC_RELEASE);
+        __atomic_store_n(&sweep.done.count, nr_workers, __ATOMIC_RELEASE);
+        started = 1;
+    }
+#endif
+
+    if (progress)
+    {
+        progress(2);
+    }
+
+    /* process remaining bytes */
+    for (index = skip; index < input_size; index++) {
+        max_offset = offset_ceiling(index, offset_limit);
+        sweep.index = index;
+
+        /* the work of an index is the offsets it sweeps */
+        work += max_offset;
+        if (index > skip && ((settings->work_limit > 0 && work > settings->work_limit) || (deadline && zx0_seconds() > deadline))) {
+            break;
+        }
+
+        /* indices with too few offsets to share out are swept on this thread alone */
+        if (nr_workers == 1 || max_offset < nr_workers*THREAD_OFFSETS) {
+            workers[0].first_offset = 1;
+            workers[0].last_offset = max_offset;
+            if (!zx0_sweep(&sweep, &workers[0], &optimal[index])) {
+                goto fail;
+            }
+        }
+#ifndef ZX0_NO_THREADS
+        else {
+            for (i = 0; i < nr_workers; i++) {
+                workers[i].first_offset = 1 + (int)((long)max_offset*i/nr_workers);
+                workers[i].last_offset = (int)((long)max_offset*(i+1)/nr_workers);
+            }
+            zx0_barrier_wait(&sweep.start);
+            if (!zx0_sweep(&sweep, &workers[0], &workers[0].best)) {
+                workers[0].failed = 1;
+            }
+            zx0_barrier_wait(&sweep.done);
+
+            /* the first cheapest block in offset order wins, as in a serial sweep */
+            for (i = 0; i < nr_workers; i++) {
+                if (workers[i].failed) {
+                    goto fail;
+                }
+                if (workers[i].best) {
+                    if (!optimal[index] || optimal[index]->bits > workers[i].best->bits)
+                        zx0_assign(&optimal[index], workers[i].best, pool);
+                    zx0_release(workers[i].best, pool);
+                    workers[i].best = NULL;
+                }
+            }
+        }
+#endif
+
+        if (ceiling) {
+            if (!((index-skip+1) % CEILING_CHECK) &&
+                zx0_beyond_ceiling(&sweep, skip, index, max_offset, literal_floor, __atomic_load_n(ceiling, __ATOMIC_RELAXED))) {
+                *stop_index = index;
+                goto fail;
+            }
+            if (literal_floor > optimal[index]->bits - (index+1)*8)
+                literal_floor = optimal[index]->bits - (index+1)*8;
+        }
+
+        if (progress && (((index * MAX_SCALE) / input_size) > dots))
+        {
+            dots++;
+            progress(dots);
+        }
+    }
+
+    if (progress)
+    {
+        progress(MAX_SCALE);
+    }
+
+    result = optimal[index-1];
+    *stop_index = index;
+
+fail:
+#ifndef ZX0_NO_THREADS
+    if (started)
+    {
+        zx0_stop_workers(&sweep, workers, nr_workers);
+    }
+#endif
+    /* only the blocks are needed to encode, and those stay in the pools */
+    return result;
+}
+
+
+
+/* quick parse */
+
+
+
+#define QUICK_WINDOW 32768
+#define QUICK_CHAIN 16
+#define QUICK_NICE_LENGTH 256
+
+typedef struct zx0_quick_t {
+    const unsigned char *input_data;
+    int input_size;
+    int offset_limit;
+    int max_chain;
+    int *head;
+    int *prev;
+} zx0_QUICK;
+
+static void zx0_quick_insert(zx0_QUICK *q, int index) {
+    int key;
+
+    if (index+1 < q->input_size) {
+        key = q->input_data[index] << 8 | q->input_data[index+1];
+        q->prev[index & (QUICK_WINDOW-1)] = q->head[key];
+        q->head[key] = index;
+    }
+}
+
+static int zx0_quick_length(zx0_QUICK *q, int index, int offset) {
+    const unsigned char *input_data = q->input_data;
+    int length = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    unsigned long long a;
+    unsigned long long b;
+
+    /* compare a word at a time, the first differing byte is the lowest set one */
+    while (index+length+8 <= q->input_size) {
+        memcpy(&a, &input_data[index+length], 8);
+        memcpy(&b, &input_data[index+length-offset], 8);
+        if (a != b)
+            return length + __builtin_ctzll(a ^ b)/8;
+        length += 8;
+    }
+#endif
+
+    while (index+length < q->input_size && input_data[index+length] == input_data[index+length-offset])
+        length++;
+    return length;
+}
+
+/* find the match at index that saves most bits over literals, returns the saving */
+static int zx0_quick_find(zx0_QUICK *q, int index, int last_offset, int after_literal, int *best_offset, int *best_length) {
+    int best_savings = 0;
+    int longest = 1;
+    int savings;
+    int offset;
+    int length;
+    int candidate;
+    int steps;
+
+    /* copy from last offset is only possible after literals */
+    if (after_literal && index >= last_offset) {
+        length = zx0_quick_length(q, index, last_offset);
+        if (length) {
+            longest = length;
+            best_savings = length*8 - 1 - elias_gamma_bits(length);
+            *best_offset = last_offset;
+            *best_length = length;
+        }
+    }
+    if (longest >= QUICK_NICE_LENGTH) {
+        return best_savings;
+    }
+
+    if (index+1 >= q->input_size) {
+        return best_savings;
+    }
+    candidate = q->head[q->input_data[index] << 8 | q->input_data[index+1]];
+    for (steps = 0; candidate >= 0 && steps < q->max_chain; steps++) {
+        offset = index-candidate;
+        if (offset > q->offset_limit) {
+            break;
+        }
+        /* a farther offset must be longer to be any better */
+        if (offset != last_offset && index+longest < q->input_size &&
+            q->input_data[index+longest] == q->input_data[index+longest-offset]) {
+            length = zx0_quick_length(q, index, offset);
+            savings = length*8 - 8 - elias_gamma_bits((offset-1)/128+1) - elias_gamma_bits(length-1);
+            if (savings > best_savings) {
+                best_savings = savings;
+                *best_offset = offset;
+                *best_length = length;
+            }
+            if (length > longest) {
+                longest = length;
+                if (length >= QUICK_NICE_LENGTH) {
+                    break;
+                }
+            }
+        }
+        candidate = q->prev[candidate & (QUICK_WINDOW-1)];
+    }
+
+    return best_savings;
+}
+
+/*
+ * Greedy parse with one step of lazy evaluation of input_data[start..], producing the same block chain as
+ * zx0_optimize. It carries on from chain, which ends at start-1 or, with literals pending since literal_index,
+ * before it; last_offset is the offset of the last match in chain.
+ */
+static zx0_BLOCK *zx0_quick_parse(zx0_CONTEXT *context, zx0_POOL *pool, const unsigned char *input_data, int input_size, int skip, int start,
+                                  zx0_BLOCK *chain, int literal_index, int last_offset, int offset_limit, int max_chain)
+{
+    zx0_QUICK q;
+    int index;
+    int offset = 0;
+    int length = 0;
+    int next_offset = 0;
+    int next_length = 0;
+    int next_savings = 0;
+    int carried = 0;
+    int indexed;
+    int savings;
+    int bits;
+    int i;
+
+    q.input_data = input_data;
+    q.input_size = input_size;
+    q.offset_limit = offset_limit > QUICK_WINDOW-1 ? QUICK_WINDOW-1 : offset_limit;
+    q.max_chain = max_chain;
+
+    if (!context->head)
+        context->head = malloc(256*256 * sizeof(int));
+    if (!context->prev)
+        context->prev = malloc(QUICK_WINDOW * sizeof(int));
+    q.head = context->head;
+    q.prev = context->prev;
+    if (!q.head || !q.prev)
+    {
+        return NULL;
+    }
+    memset(q.head, -1, 256*256 * sizeof(int));
+
+    /* index skipped bytes */
+    for (i = start > q.offset_limit ? start-q.offset_limit : 0; i < start; i++) {
+        zx0_quick_insert(&q, i);
+    }
+
+    for (index = start; index < input_size; ) {
+        savings = 0;
+        indexed = 0;
+        /* first byte is always literal */
+        if (index != skip) {
+            if (carried) {
+                /* found as the next position on the last step, with the same chains and last offset */
+                savings = next_savings;
+                offset = next_offset;
+                length = next_length;
+            } else {
+                savings = zx0_quick_find(&q, index, last_offset, literal_index >= 0, &offset, &length);
+            }
+            carried = 0;
+            /* prefer a literal here if the next position has a much better match, searched as it will be
+               after that literal so the next step can take it over */
+            if (savings > 0 && index+1 < input_size) {
+                zx0_quick_insert(&q, index);
+                indexed = 1;
+                next_savings = zx0_quick_find(&q, index+1, last_offset, 1, &next_offset, &next_length);
+                if (next_savings > savings+8) {
+                    savings = 0;
+                    carried = 1;
+                }
+            }
+        }
+
+        if (savings <= 0) {
+            if (literal_index < 0) {
+                literal_index = index;
+            }
+            if (!indexed) {
+                zx0_quick_insert(&q, index);
+            }
+            index++;
+            continue;
+        }
+
+        if (literal_index >= 0) {
+            /* copy literals */
+            bits = chain->bits + 1 + elias_gamma_bits(index-literal_index) + (index-literal_index)*8;
+            chain = zx0_allocate(pool, bits, index-1, 0, chain);
+            if (!chain) {
+                return NULL;
+            }
+        }
+        if (literal_index >= 0 && offset == last_offset) {
+            /* copy from last offset */
+            bits = chain->bits + 1 + elias_gamma_bits(length);
+        } else {
+            /* copy from new offset */
+            bits = chain->bits + 8 + elias_gamma_bits((offset-1)/128+1) + elias_gamma_bits(length-1);
+        }
+        chain = zx0_allocate(pool, bits, index+length-1, offset, chain);
+        if (!chain) {
+            return NULL;
+        }
+        for (i = indexed; i < length; i++) {
+            zx0_quick_insert(&q, index+i);
+        }
+        index += length;
+        last_offset = offset;
+        literal_index = -1;
+    }
 
-    best_length = malloc(input_size * sizeof(int));
-    if (best_length == NULL)
-    {
-        goto fail;
+    if (literal_index >= 0) {
+        /* copy literals */
+        bits = chain->bits + 1 + elias_gamma_bits(input_size-literal_index) + (input_size-literal_index)*8;
+        chain = zx0_allocate(pool, bits, input_size-1, 0, chain);
     }
-    allocated_mem[(*nr_allocs)] = best_length;
-    (*nr_allocs)++;
 
-    optimal = calloc(input_size, sizeof(zx0_BLOCK *));
-    if (optimal == NULL)
-    {
-        goto fail;
-    }
-    allocated_mem[(*nr_allocs)] = optimal;
-    (*nr_allocs)++;
+    return chain && chain->index == input_size-1 ? chain : NULL;
+}
 
-    if (input_size > 2)
-    {
-        best_length[2] = 2;
-    }
+static zx0_BLOCK *zx0_quick_optimize(zx0_CONTEXT *context, zx0_POOL *pool, const unsigned char *input_data, int input_size, int skip, int offset_limit, int max_chain, void (*progress)(int))
+{
+    zx0_BLOCK *chain;
+
+    pool->shared = 0;
 
     if (progress)
     {
@@ -179,95 +1185,18 @@ static zx0_BLOCK *zx0_optimize(const unsigned char *input_data, int input_size,
     }
 
     /* start with fake block */
-    zx0_allocate(chain, -1, skip-1, INITIAL_OFFSET, NULL);
+    chain = zx0_allocate(pool, -1, skip-1, INITIAL_OFFSET, NULL);
     if (!chain) {
-        goto fail;
-    }
-    zx0_assign(&last_match[INITIAL_OFFSET], chain, &ghost_root);
-
-    if (progress)
-    {
-        progress(2);
-    }
-
-    /* process remaining bytes */
-    for (index = skip; index < input_size; index++) {
-        best_length_size = 2;
-        max_offset = offset_ceiling(index, offset_limit);
-        for (offset = 1; offset <= max_offset; offset++) {
-            if (index != skip && index >= offset && input_data[index] == input_data[index-offset]) {
-                /* copy from last offset */
-                if (last_literal[offset]) {
-                    length = index-last_literal[offset]->index;
-                    bits = last_literal[offset]->bits + 1 + elias_gamma_bits(length);
-                    zx0_allocate(chain, bits, index, offset, last_literal[offset]);
-                    if (!chain) {
-                        goto fail;
-                    }
-                    zx0_assign(&last_match[offset], chain, &ghost_root);
-                    if (!optimal[index] || optimal[index]->bits > bits)
-                        zx0_assign(&optimal[index], last_match[offset], &ghost_root);
-                }
-                /* copy from new offset */
-                if (++match_length[offset] > 1) {
-                    if (best_length_size < match_length[offset]) {
-                        bits = optimal[index-best_length[best_length_size]]->bits + elias_gamma_bits(best_length[best_length_size]-1);
-                        do {
-                            best_length_size++;
-                            bits2 = optimal[index-best_length_size]->bits + elias_gamma_bits(best_length_size-1);
-                            if (bits2 <= bits) {
-                                best_length[best_length_size] = best_length_size;
-                                bits = bits2;
-                            } else {
-                                best_length[best_length_size] = best_length[best_length_size-1];
-                            }
-                        } while(best_length_size < match_length[offset]);
-                    }
-                    length = best_length[match_length[offset]];
-                    bits = optimal[index-length]->bits + 8 + elias_gamma_bits((offset-1)/128+1) + elias_gamma_bits(length-1);
-                    if (!last_match[offset] || last_match[offset]->index != index || last_match[offset]->bits > bits) {
-                        zx0_allocate(chain, bits, index, offset, optimal[index-length]);
-                        if (!chain) {
-                            goto fail;
-                        }
-                        zx0_assign(&last_match[offset], chain, &ghost_root);
-                        if (!optimal[index] || optimal[index]->bits > bits)
-                            zx0_assign(&optimal[index], last_match[offset], &ghost_root);
-                    }
-                }
-            } else {
-                /* copy literals */
-                match_length[offset] = 0;
-                if (last_match[offset]) {
-                    length = index-last_match[offset]->index;
-                    bits = last_match[offset]->bits + 1 + elias_gamma_bits(length) + length*8;
-                    zx0_allocate(chain, bits, index, 0, last_match[offset]);
-                    if (!chain) {
-                        goto fail;
-                    }
-                    zx0_assign(&last_literal[offset], chain, &ghost_root);
-                    if (!optimal[index] || optimal[index]->bits > bits)
-                        zx0_assign(&optimal[index], last_literal[offset], &ghost_root);
-                }
-            }
-        }
-
-        if (progress && (((index * MAX_SCALE) / input_size) > dots))
-        {
-            dots++;
-            progress(dots);
-        }
+        return NULL;
     }
+    chain = zx0_quick_parse(context, pool, input_data, input_size, skip, skip, chain, -1, INITIAL_OFFSET, offset_limit, max_chain);
 
     if (progress)
     {
         progress(MAX_SCALE);
     }
 
-    return optimal[input_size-1];
-
-fail:
-    return NULL;
+    return chain;
 }
 
 
@@ -276,36 +1205,55 @@ fail:
 
 
 
+/* the bit writer state, kept between the segments of a stream; without output_data it only counts */
+typedef struct zx0_encoder_t {
+    unsigned char *output_data;
+    int output_index;
+    int input_index;
+    int bit_index;
+    int bit_mask;
+    int backtrack;
+    int last_offset;
+    int backwards_mode;
+    int invert_mode;
+    long diff;
+    long delta;
+    zx0_STATS *stats;           /* may be NULL */
+    const zx0_CYCLES *cycles;   /* decode cycles to add up in stats, may be NULL */
+} zx0_ENCODER;
+
 #define read_bytes(n) \
 do { \
-    input_index += n; \
-    diff += n; \
-    if (*delta < diff) \
-        *delta = diff; \
+    e->input_index += n; \
+    e->diff += n; \
+    if (e->delta < e->diff) \
+        e->delta = e->diff; \
 } while (0)
 
 #define write_byte(n) \
 do { \
-    output_data[output_index++] = n; \
-    diff--; \
+    if (e->output_data) \
+        e->output_data[e->output_index] = n; \
+    e->output_index++; \
+    e->diff--; \
 } while (0)
 
 #define write_bit(v) \
 do { \
     int v0 = v; \
-    if (backtrack) { \
-        if (v0 && output_index) \
-            output_data[output_index-1] |= 1; \
-        backtrack = 0; \
+    if (e->backtrack) { \
+        if (v0 && e->output_index && e->output_data) \
+            e->output_data[e->output_index-1] |= 1; \
+        e->backtrack = 0; \
     } else { \
-        if (!bit_mask) { \
-            bit_mask = 128; \
-            bit_index = output_index; \
+        if (!e->bit_mask) { \
+            e->bit_mask = 128; \
+            e->bit_index = e->output_index; \
             write_byte(0); \
         } \
-        if (v0) \
-            output_data[bit_index] |= bit_mask; \
-        bit_mask >>= 1; \
+        if (v0 && e->output_data) \
+            e->output_data[e->bit_index] |= e->bit_mask; \
+        e->bit_mask >>= 1; \
     } \
 } while (0)
 
@@ -316,76 +1264,69 @@ do { \
     for (i = 2; i <= v1; i <<= 1); \
     i >>= 1; \
     while (i >>= 1) { \
-        write_bit(backwards_mode); \
+        write_bit(e->backwards_mode); \
         write_bit((h) ? !(v1 & i) : (v1 & i)); \
     } \
-    write_bit(!backwards_mode); \
+    write_bit(!e->backwards_mode); \
 } while (0)
 
-unsigned char *zx0_compress(const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int))
-{
-    void **allocated_mem;
-    size_t nr_allocs;
-    unsigned char *output_data = NULL;
-    int output_index;
-    int input_index;
-    int bit_index;
-    int bit_mask;
-    int diff;
-    int backtrack;
-    zx0_BLOCK *prev;
+/* turn the chain ending at optimal around, returning the fake block it started with */
+static zx0_BLOCK *zx0_unreverse(zx0_BLOCK *optimal) {
+    zx0_BLOCK *prev = NULL;
     zx0_BLOCK *next;
-    int last_offset = INITIAL_OFFSET;
-    int length;
-    zx0_BLOCK *optimal;
-
-    nr_allocs = 0;
-
-    allocated_mem = calloc(MAX_ALLOCS, sizeof(void *));
-    if (!allocated_mem)
-    {
-        goto fail;
-    }
-
-    optimal = zx0_optimize(input_data, input_size, skip, ZX0_MAX_OFFSET, progress, allocated_mem, &nr_allocs);
-    if (!optimal)
-    {
-        goto fail;
-    }
-
-    /* calculate and allocate output buffer */
-    *output_size = (optimal->bits+25)/8;
-    output_data = calloc(*output_size, sizeof(unsigned char));
-    if (!output_data)
-    {
-        goto fail;
-    }
-
-    bit_index = 0;
 
-    /* un-reverse optimal sequence */
-    prev = NULL;
-    next = NULL;
     while (optimal) {
         next = optimal->chain;
         optimal->chain = prev;
         prev = optimal;
         optimal = next;
     }
+    return prev;
+}
+
+/* where the bits of each token go, and what decoding it takes */
+static void zx0_count(zx0_STATS *stats, const zx0_CYCLES *cycles, int type, int length, int offset, int first) {
+    if (cycles) {
+        if (type == 0)
+            stats->decode_cycles += cycles->literal + (long)cycles->literal_byte*length + cycles->gamma_bit*elias_gamma_bits(length);
+        else if (type == 1)
+            stats->decode_cycles += cycles->repeat + (long)cycles->copy_byte*length + cycles->gamma_bit*elias_gamma_bits(length);
+        else
+            stats->decode_cycles += cycles->new_offset + (long)cycles->copy_byte*length +
+                                    cycles->gamma_bit*(elias_gamma_bits((offset-1)/128+1) + elias_gamma_bits(length-1));
+    }
+    stats->flag_bits += !first;
+    if (type == 0) {
+        stats->literal_runs++;
+        stats->literal_bytes += length;
+        stats->literal_bits += length*8;
+        stats->length_bits += elias_gamma_bits(length);
+    } else {
+        stats->match_bytes += length;
+        if (type == 1) {
+            stats->repeat_matches++;
+            stats->length_bits += elias_gamma_bits(length);
+        } else {
+            stats->new_matches++;
+            stats->offset_bits += elias_gamma_bits((offset-1)/128+1) + 7;
+            stats->length_bits += elias_gamma_bits(length-1);
+        }
+    }
+}
 
-    /* initialize data */
-    diff = *output_size-input_size+skip;
-    *delta = 0;
-    input_index = skip;
-    output_index = 0;
-    bit_mask = 0;
-    backtrack = 1;
+/* encode the blocks after the fake one, as left by zx0_unreverse, reading the bytes from e->input_index on */
+static void zx0_encode(zx0_ENCODER *e, const unsigned char *input_data, zx0_BLOCK *prev) {
+    zx0_BLOCK *optimal;
+    int length;
 
     /* generate output */
     for (optimal = prev->chain; optimal; prev=optimal, optimal = optimal->chain) {
         length = optimal->index-prev->index;
 
         if (!optimal->offset) {
+            if (e->stats)
+                zx0_count(e->stats, e->cycles, 0, length, 0, e->backtrack);
+
             /* copy literals indicator */
             write_bit(0);
 
@@ -394,10 +1335,13 @@ unsigned char *zx0_compress(const unsigned char *input_data, int input_size, int
 
             /* copy literals values */
             for (int j = 0; j < length; j++) {
-                write_byte(input_data[input_index]);
+                write_byte(input_data[e->input_index]);
                 read_bytes(1);
             }
-        } else if (optimal->offset == last_offset) {
+        } else if (optimal->offset == e->last_offset) {
+            if (e->stats)
+                zx0_count(e->stats, e->cycles, 1, length, optimal->offset, 0);
+
             /* copy from last offset indicator */
             write_bit(0);
 
@@ -405,39 +1349,654 @@ unsigned char *zx0_compress(const unsigned char *input_data, int input_size, int
             write_interlaced_elias_gamma(length, 0);
             read_bytes(length);
         } else {
+            if (e->stats)
+                zx0_count(e->stats, e->cycles, 2, length, optimal->offset, 0);
+
             /* copy from new offset indicator */
             write_bit(1);
 
             /* copy from new offset MSB */
-            write_interlaced_elias_gamma((optimal->offset-1)/128+1, invert_mode);
+            write_interlaced_elias_gamma((optimal->offset-1)/128+1, e->invert_mode);
 
             /* copy from new offset LSB */
-            if (backwards_mode)
+            if (e->backwards_mode)
                 write_byte(((optimal->offset-1)%128)<<1);
             else
                 write_byte((127-(optimal->offset-1)%128)<<1);
 
             /* copy from new offset length */
-            backtrack = 1;
+            e->backtrack = 1;
             write_interlaced_elias_gamma(length-1, 0);
             read_bytes(length);
 
-            last_offset = optimal->offset;
+            e->last_offset = optimal->offset;
         }
     }
+}
+
+static void zx0_encode_end(zx0_ENCODER *e) {
+    if (e->stats) {
+        e->stats->end_bits += 1 + elias_gamma_bits(256);
+        if (e->cycles)
+            e->stats->decode_cycles += e->cycles->gamma_bit*elias_gamma_bits(256);
+    }
 
     /* end marker */
     write_bit(1);
-    write_interlaced_elias_gamma(256, invert_mode);
+    write_interlaced_elias_gamma(256, e->invert_mode);
+}
 
-fail:
+/* parser, window and quick parse chain steps of each level */
+static const int zx0_levels[ZX0_MAX_LEVEL][3] = {
+    { 1,           2048,  4 },
+    { 1,           8192, 16 },
+    { 1, ZX0_MAX_OFFSET, 64 },
+    { 0,           1024,  0 },
+    { 0,           2048,  0 },
+    { 0,           4096,  0 },
+    { 0,           8192,  0 },
+    { 0,          16384,  0 },
+    { 0, ZX0_MAX_OFFSET,  0 }
+};
+
+int zx0_level_options(int level, zx0_OPTIONS *options) {
+    if (level < ZX0_MIN_LEVEL || level > ZX0_MAX_LEVEL)
+        return 0;
+    options->quick = zx0_levels[level-1][0];
+    options->level = level;
+    options->window = zx0_levels[level-1][1];
+    options->chain = zx0_levels[level-1][2];
+    return 1;
+}
+
+/* counted on dzx0_standard: LDIR copies, the Elias loop takes about 30 T-states a bit with its refills */
+void zx0_z80_cycles(zx0_CYCLES *cycles) {
+    cycles->literal = 27;
+    cycles->literal_byte = 21;
+    cycles->repeat = 100;
+    cycles->new_offset = 210;
+    cycles->copy_byte = 21;
+    cycles->gamma_bit = 30;
+}
+
+/* resolve the level, window and chain of options into settings, returns 0 for a bad level */
+static int zx0_settings(const zx0_OPTIONS *options, zx0_OPTIONS *settings) {
+    /* explicit window and chain win over the ones of the level */
+    memset(settings, 0, sizeof *settings);
+    if (options)
+        *settings = *options;
+    if (settings->level && !zx0_level_options(settings->level, settings))
+        return 0;
+    if (options && options->window)
+        settings->window = options->window;
+    if (options && options->chain)
+        settings->chain = options->chain;
+    if (settings->window <= 0 || settings->window > ZX0_MAX_OFFSET)
+        settings->window = ZX0_MAX_OFFSET;
+    if (settings->chain <= 0)
+        settings->chain = QUICK_CHAIN;
+    return 1;
+}
+
+/* parse input_data with the settings of options, the blocks stay in the arena until its next reset */
+static zx0_BLOCK *zx0_parse(zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, void (*progress)(int), const zx0_OPTIONS *options)
+{
+    zx0_ARENA *arena = options && options->arena ? options->arena : context->arena;
+    zx0_OPTIONS settings;
+    zx0_STATS *stats = options ? options->stats : NULL;
+    zx0_BLOCK *optimal;
+    double start = 0;
+    int stop_index = input_size;
+    int literal_index = -1;
+    int i;
+
+    if (!zx0_settings(options, &settings))
+        return NULL;
+    if (stats) {
+        memset(stats, 0, sizeof *stats);
+        start = zx0_seconds();
+    }
+
+    zx0_arena_reset(arena);
+    if (settings.quick) {
+        optimal = zx0_quick_optimize(context, arena->pools, input_data, input_size, skip, settings.window, settings.chain, progress);
+    } else {
+        optimal = zx0_optimize(context, arena->pools, input_data, input_size, skip, &settings, 0, INITIAL_OFFSET, progress, &stop_index);
+        if (optimal && stop_index < input_size) {
+            /* out of budget, the quick parse finishes from the best block so far, reopening its literals */
+            if (!optimal->offset) {
+                literal_index = optimal->chain->index+1;
+                optimal = optimal->chain;
+            }
+            arena->pools[0].shared = 0;
+            optimal = zx0_quick_parse(context, &arena->pools[0], input_data, input_size, skip, stop_index, optimal, literal_index,
+                                      optimal->offset, settings.window, settings.chain);
+        }
+    }
+
+    if (stats) {
+        stats->budget_index = optimal && stop_index < input_size ? stop_index : -1;
+        stats->ceiling_index = !optimal && stop_index < input_size ? stop_index : -1;
+        stats->optimize_seconds = zx0_seconds()-start;
+        /* slabs are only freed on reset, so what the pools hold now is the peak of this parse */
+        for (i = 0; i < ZX0_MAX_THREADS; i++) {
+            stats->blocks_allocated += arena->pools[i].allocated;
+            stats->blocks_recycled += arena->pools[i].recycled;
+            stats->arena_bytes += arena->pools[i].bytes;
+        }
+    }
+    return optimal;
+}
+
+/* bits of the stream the parse ending at optimal encodes, which only its cost tells without a weighted model */
+static int zx0_parse_bits(const zx0_BLOCK *optimal, const zx0_OPTIONS *options) {
+    const zx0_BLOCK *prev;
+    const zx0_BLOCK *match;
+    int bits = 0;
+    int length;
+
+    if (!zx0_weighted(options))
+        return optimal->bits;
+    for (; optimal->chain; optimal = prev) {
+        prev = optimal->chain;
+        length = optimal->index-prev->index;
+        if (!optimal->offset) {
+            bits += 1 + elias_gamma_bits(length) + length*8;
+        } else {
+            /* the encoder repeats the offset of the match before, whatever the parse meant */
+            match = prev->offset ? prev : prev->chain;
+            if (optimal->offset == match->offset)
+                bits += 1 + elias_gamma_bits(length);
+            else
+                bits += 8 + elias_gamma_bits((optimal->offset-1)/128+1) + elias_gamma_bits(length-1);
+        }
+    }
+    /* the fake block takes back the indicator of the first literal */
+    return optimal->bits < 0 ? bits-1 : bits;
+}
+
+/* encode the parse ending at optimal into output_data, or only count its bytes without output_data */
+static void zx0_encode_all(zx0_ENCODER *e, unsigned char *output_data, int output_size, const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, zx0_BLOCK *optimal, const zx0_OPTIONS *options)
+{
+    zx0_STATS *stats = options ? options->stats : NULL;
+    double start = 0;
+
+    memset(e, 0, sizeof *e);
+    e->output_data = output_data;
+    e->backwards_mode = backwards_mode;
+    e->invert_mode = invert_mode;
+    e->diff = output_size-input_size+skip;
+    e->input_index = skip;
+    e->backtrack = 1;
+    e->last_offset = INITIAL_OFFSET;
+    e->stats = stats;
+    e->cycles = options ? options->cycles : NULL;
+
+    if (stats)
+        start = zx0_seconds();
+    optimal = zx0_unreverse(optimal);
+    if (stats) {
+        stats->unreverse_seconds = zx0_seconds()-start;
+        start = zx0_seconds();
+    }
+    zx0_encode(e, input_data, optimal);
+    zx0_encode_end(e);
+    if (stats)
+        stats->encode_seconds = zx0_seconds()-start;
+}
+
+static unsigned char *zx0_compress_segmented(zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int), const zx0_OPTIONS *options);
+
+unsigned char *zx0_context_compress(zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int), const zx0_OPTIONS *options)
+{
+    zx0_ENCODER encoder;
+    zx0_BLOCK *optimal;
+    zx0_OPTIONS settings;
+    unsigned char *output_data;
+
+    if (options && options->segmented) {
+        if (!zx0_settings(options, &settings))
+            return NULL;
+        if (!settings.quick)
+            return zx0_compress_segmented(context, input_data, input_size, skip, backwards_mode, invert_mode, output_size, delta, progress, options);
+    }
+
+    optimal = zx0_parse(context, input_data, input_size, skip, progress, options);
+    if (!optimal)
+    {
+        return NULL;
+    }
 
-    for (size_t j = 0; j < nr_allocs; ++j) {
-        free(allocated_mem[j]);
-        allocated_mem[j] = NULL;
+    /* calculate and allocate output buffer */
+    *output_size = (zx0_parse_bits(optimal, options)+25)/8;
+    output_data = calloc(*output_size, sizeof(unsigned char));
+    if (!output_data)
+    {
+        return NULL;
     }
-    free(allocated_mem);
+
+    zx0_encode_all(&encoder, output_data, *output_size, input_data, input_size, skip, backwards_mode, invert_mode, optimal, options);
+    *delta = (int)encoder.delta;
 
     /* done! */
     return output_data;
 }
+
+int zx0_context_estimate(zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int *delta, const zx0_OPTIONS *options)
+{
+    zx0_ENCODER encoder;
+    zx0_BLOCK *optimal;
+    int output_size;
+
+    optimal = zx0_parse(context, input_data, input_size, skip, NULL, options);
+    if (!optimal)
+        return -1;
+
+    /* the modes change bit values but not where they go, so the counting walk gives delta for all of them */
+    output_size = (zx0_parse_bits(optimal, options)+25)/8;
+    zx0_encode_all(&encoder, NULL, output_size, input_data, input_size, skip, 0, 0, optimal, options);
+    if (delta)
+        *delta = (int)encoder.delta;
+    return output_size;
+}
+
+int zx0_estimate(const unsigned char *input_data, int input_size, int skip, int *delta, const zx0_OPTIONS *options)
+{
+    zx0_CONTEXT *context;
+    int output_size;
+
+    context = zx0_context_create();
+    if (!context)
+        return -1;
+    output_size = zx0_context_estimate(context, input_data, input_size, skip, delta, options);
+    zx0_context_free(context);
+    return output_size;
+}
+
+#define ESTIMATE_CHAIN 256
+
+int zx0_estimate_quick(const unsigned char *input_data, int input_size, int skip, int *delta)
+{
+    zx0_OPTIONS options;
+
+    /* the quick parse over the whole window, searching deeper than any level does */
+    memset(&options, 0, sizeof options);
+    options.quick = 1;
+    options.chain = ESTIMATE_CHAIN;
+    return zx0_estimate(input_data, input_size, skip, delta, &options);
+}
+
+unsigned char *zx0_compress_ex(const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int), const zx0_OPTIONS *options)
+{
+    zx0_CONTEXT *context;
+    unsigned char *output_data;
+
+    context = zx0_context_create();
+    if (!context)
+        return NULL;
+    output_data = zx0_context_compress(context, input_data, input_size, skip, backwards_mode, invert_mode, output_size, delta, progress, options);
+    zx0_context_free(context);
+    return output_data;
+}
+
+unsigned char *zx0_compress(const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int))
+{
+    return zx0_compress_ex(input_data, input_size, skip, backwards_mode, invert_mode, output_size, delta, progress, NULL);
+}
+
+
+
+/* streaming */
+
+
+
+#define STREAM_SEGMENT 32768
+#define STREAM_PENDING (4*STREAM_SEGMENT)
+#define STREAM_LOOKAHEAD 1024
+#define STREAM_SLACK 32
+
+struct zx0_stream_t {
+    zx0_CONTEXT *context;
+    int borrowed;               /* the context belongs to the caller */
+    zx0_OPTIONS settings;
+    zx0_ENCODER encoder;
+    int output_capacity;
+    unsigned char *buffer;      /* up to a window of bytes already encoded, then the pending ones */
+    int capacity;
+    int history;
+    int size;
+    int resume;
+    int failed;
+    long input_total;
+    long output_total;
+    void (*write)(void *user, const unsigned char *output_data, int output_size);
+    void *user;
+};
+
+static zx0_STREAM *zx0_stream_open(zx0_CONTEXT *context, int backwards_mode, int invert_mode, const zx0_OPTIONS *options, void (*write)(void *user, const unsigned char *output_data, int output_size), void *user) {
+    zx0_STREAM *stream;
+
+    stream = calloc(1, sizeof(zx0_STREAM));
+    if (!stream)
+        return NULL;
+    if (!zx0_settings(options, &stream->settings)) {
+        free(stream);
+        return NULL;
+    }
+    stream->settings.stats = NULL;
+    stream->settings.time_limit = 0;
+    stream->settings.work_limit = 0;
+    stream->settings.lambda = 0;
+    stream->settings.ceiling = NULL;
+    stream->context = context ? context : zx0_context_create();
+    stream->borrowed = context != NULL;
+    stream->capacity = stream->settings.window + STREAM_SEGMENT;
+    stream->buffer = malloc(stream->capacity);
+    if (!stream->context || !stream->buffer) {
+        zx0_stream_free(stream);
+        return NULL;
+    }
+    stream->encoder.backtrack = 1;
+    stream->encoder.last_offset = INITIAL_OFFSET;
+    stream->encoder.backwards_mode = backwards_mode;
+    stream->encoder.invert_mode = invert_mode;
+    stream->encoder.delta = LONG_MIN;
+    stream->write = write;
+    stream->user = user;
+    return stream;
+}
+
+zx0_STREAM *zx0_stream_create(int backwards_mode, int invert_mode, const zx0_OPTIONS *options, void (*write)(void *user, const unsigned char *output_data, int output_size), void *user) {
+    return zx0_stream_open(NULL, backwards_mode, invert_mode, options, write, user);
+}
+
+void zx0_stream_free(zx0_STREAM *stream) {
+    if (!stream)
+        return;
+    if (!stream->borrowed)
+        zx0_context_free(stream->context);
+    free(stream->encoder.output_data);
+    free(stream->buffer);
+    free(stream);
+}
+
+static int zx0_stream_reserve(zx0_STREAM *stream, int bytes) {
+    zx0_ENCODER *e = &stream->encoder;
+    unsigned char *output_data;
+
+    if (stream->output_capacity - e->output_index >= bytes)
+        return 1;
+    output_data = realloc(e->output_data, e->output_index + bytes);
+    if (!output_data)
+        return 0;
+    e->output_data = output_data;
+    stream->output_capacity = e->output_index + bytes;
+    return 1;
+}
+
+/* hand over the bytes no later bit can change, all of them once the stream is complete */
+static void zx0_stream_emit(zx0_STREAM *stream, int all) {
+    zx0_ENCODER *e = &stream->encoder;
+    int done = all || !e->bit_mask ? e->output_index : e->bit_index;
+
+    if (!done)
+        return;
+    stream->write(stream->user, e->output_data, done);
+    memmove(e->output_data, e->output_data+done, e->output_index-done);
+    e->output_index -= done;
+    e->bit_index -= done;
+    stream->output_total += done;
+}
+
+/*
+ * Move common down to where the chain of block meets it. Blocks known to descend from common carry stamp in
+ * ghost_chain, which is free while a block is live, so every block is walked about once whatever the roots.
+ */
+static zx0_BLOCK *zx0_meet(zx0_BLOCK *common, zx0_BLOCK *block, zx0_BLOCK *stamp) {
+    zx0_BLOCK *walk;
+
+    if (!block)
+        return common;
+    for (walk = block; walk->ghost_chain != stamp; ) {
+        if (walk->index > common->index) {
+            walk = walk->chain;
+        } else {
+            /* walk is not below common, which has to move down to it */
+            if (!common->chain)
+                return common;
+            common = common->chain;
+            common->ghost_chain = stamp;
+        }
+    }
+    for (walk = block; walk->ghost_chain != stamp; walk = walk->chain)
+        walk->ghost_chain = stamp;
+    return common;
+}
+
+/*
+ * Latest block every live chain of the parse of buffer[..size-1] goes through, which no later input can change:
+ * the blocks a match still running at any offset may start from, and the last match and literal of every
+ * offset whose next repeat could still compete with a new offset match from the best block.
+ */
+static zx0_BLOCK *zx0_stream_converged(zx0_STREAM *stream) {
+    zx0_CONTEXT *context = stream->context;
+    zx0_OFFSET *offsets = context->offsets;
+    zx0_BLOCK **optimal = context->optimal;
+    zx0_BLOCK stamp;
+    zx0_BLOCK *common;
+    int last = stream->size-1;
+    int max_offset = offset_ceiling(last, stream->settings.window);
+    int limit = optimal[last]->bits + STREAM_SLACK;
+    int first = last;
+    int length;
+    int bits;
+    int i;
+
+    for (i = 1; i <= max_offset; i++) {
+        if (first > last-offsets[i].match_length)
+            first = last-offsets[i].match_length;
+    }
+    if (first < stream->history)
+        first = stream->history;
+
+    common = optimal[last];
+    common->ghost_chain = &stamp;
+    for (i = first; i < last; i++)
+        common = zx0_meet(common, optimal[i], &stamp);
+    for (i = 1; i <= max_offset; i++) {
+        if (!offsets[i].last_match)
+            continue;
+        length = last-offsets[i].last_match_index;
+        bits = length ? offsets[i].last_match_bits + 1 + elias_gamma_bits(length) + length*8 : offsets[i].last_match_bits;
+        if (bits <= limit) {
+            common = zx0_meet(common, offsets[i].last_match, &stamp);
+            common = zx0_meet(common, offsets[i].last_literal, &stamp);
+        }
+    }
+    return common;
+}
+
+/*
+ * Parse the pending bytes and encode them up to the end of a match, so the next parse can resume from it.
+ * That is the last match every live chain goes through, so the output is the one of a single parse. Until
+ * the chains converge the pending bytes grow a segment at a time, up to STREAM_PENDING bytes, then the bytes
+ * before the last STREAM_LOOKAHEAD are committed as the best parse has them. Returns 2 when the pending bytes
+ * should grow before anything is committed.
+ */
+static int zx0_stream_segment(zx0_STREAM *stream, int final) {
+    zx0_CONTEXT *context = stream->context;
+    zx0_ARENA *arena = stream->settings.arena ? stream->settings.arena : context->arena;
+    zx0_ENCODER *e = &stream->encoder;
+    zx0_BLOCK *optimal;
+    zx0_BLOCK *commit;
+    int stop_index;
+    int consumed;
+    int keep;
+    int index;
+
+    if (stream->size == stream->history)
+        return 1;
+
+    zx0_arena_reset(arena);
+    optimal = zx0_optimize(context, arena->pools, stream->buffer, stream->size, stream->history, &stream->settings,
+                           stream->resume, e->last_offset, NULL, &stop_index);
+    if (!optimal)
+        return 0;
+
+    commit = optimal;
+    if (!final) {
+        commit = zx0_stream_converged(stream);
+        while (commit->chain && !commit->offset)
+            commit = commit->chain;
+        if (!commit->chain && stream->size-stream->history < STREAM_PENDING)
+            return 2;
+    }
+    if (!commit->chain) {
+        commit = optimal;
+        while (commit->chain && (commit->index >= stream->size-STREAM_LOOKAHEAD || !commit->offset))
+            commit = commit->chain;
+        if (!commit->chain) {
+            /* the best parse is all literals, so settle for the last match any parse ends with */
+            commit = NULL;
+            for (index = stream->size-1; !commit && index >= stream->history; index--) {
+                if (context->optimal[index]->offset)
+                    commit = context->optimal[index];
+            }
+            if (!commit)
+                return 2;
+        }
+    }
+
+    if (!zx0_stream_reserve(stream, (commit->bits+25)/8))
+        return 0;
+    e->input_index = stream->history;
+    zx0_encode(e, stream->buffer, zx0_unreverse(commit));
+
+    /* keep a window of the encoded bytes for the matches of the next parse */
+    consumed = e->input_index;
+    keep = consumed < stream->settings.window ? consumed : stream->settings.window;
+    memmove(stream->buffer, stream->buffer+consumed-keep, stream->size-consumed+keep);
+    stream->input_total += consumed-stream->history;
+    stream->size -= consumed-keep;
+    stream->history = keep;
+    stream->resume = 1;
+
+    zx0_stream_emit(stream, 0);
+    return 1;
+}
+
+int zx0_stream_feed(zx0_STREAM *stream, const unsigned char *input_data, int input_size) {
+    unsigned char *buffer;
+    int status;
+    int n;
+
+    while (!stream->failed && input_size > 0) {
+        n = stream->capacity-stream->size < input_size ? stream->capacity-stream->size : input_size;
+        memcpy(stream->buffer+stream->size, input_data, n);
+        stream->size += n;
+        input_data += n;
+        input_size -= n;
+        if (stream->size < stream->capacity)
+            break;
+
+        status = zx0_stream_segment(stream, 0);
+        if (status == 2) {
+            /* only when not a single match pays off in a whole segment */
+            buffer = realloc(stream->buffer, stream->capacity + STREAM_SEGMENT);
+            if (!buffer) {
+                stream->failed = 1;
+                break;
+            }
+            stream->buffer = buffer;
+            stream->capacity += STREAM_SEGMENT;
+        } else if (!status) {
+            stream->failed = 1;
+        }
+    }
+    return !stream->failed;
+}
+
+int zx0_stream_flush(zx0_STREAM *stream, int *delta) {
+    zx0_ENCODER *e = &stream->encoder;
+
+    if (stream->failed || !zx0_stream_segment(stream, 1) || !stream->input_total || !zx0_stream_reserve(stream, 4)) {
+        stream->failed = 1;
+        return 0;
+    }
+    zx0_encode_end(e);
+    zx0_stream_emit(stream, 1);
+
+    /* the largest lead of input over output, measured from the end of both */
+    *delta = (int)(e->delta + stream->output_total - stream->input_total);
+    if (*delta < 0)
+        *delta = 0;
+    stream->failed = 1;
+    return 1;
+}
+
+typedef struct zx0_output_t {
+    unsigned char *data;
+    int size;
+    int capacity;
+    int failed;
+} zx0_OUTPUT;
+
+static void zx0_output_write(void *user, const unsigned char *output_data, int output_size) {
+    zx0_OUTPUT *output = user;
+    unsigned char *data;
+    int capacity;
+
+    if (output->size + output_size > output->capacity) {
+        capacity = output->capacity ? output->capacity : 4096;
+        while (capacity < output->size + output_size)
+            capacity *= 2;
+        data = realloc(output->data, capacity);
+        if (!data) {
+            output->failed = 1;
+            return;
+        }
+        output->data = data;
+        output->capacity = capacity;
+    }
+    memcpy(output->data + output->size, output_data, output_size);
+    output->size += output_size;
+}
+
+/* the optimal parse of a whole input in stream segments, with the prefix as the history of the first one */
+static unsigned char *zx0_compress_segmented(zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int), const zx0_OPTIONS *options)
+{
+    zx0_STREAM *stream;
+    zx0_OUTPUT output;
+    int dots = 1;
+    int index;
+    int n;
+
+    memset(&output, 0, sizeof output);
+    stream = zx0_stream_open(context, backwards_mode, invert_mode, options, zx0_output_write, &output);
+    if (!stream)
+        return NULL;
+    stream->history = skip < stream->settings.window ? skip : stream->settings.window;
+    memcpy(stream->buffer, input_data+skip-stream->history, stream->history);
+    stream->size = stream->history;
+
+    if (progress)
+        progress(dots);
+    for (index = skip; index < input_size && !stream->failed; index += n) {
+        n = input_size-index < STREAM_SEGMENT ? input_size-index : STREAM_SEGMENT;
+        zx0_stream_feed(stream, input_data+index, n);
+        if (progress && ((long)(index+n-skip) * MAX_SCALE) / (input_size-skip) > dots) {
+            dots = (int)(((long)(index+n-skip) * MAX_SCALE) / (input_size-skip));
+            progress(dots);
+        }
+    }
+    if (!zx0_stream_flush(stream, delta) || output.failed) {
+        zx0_stream_free(stream);
+        free(output.data);
+        return NULL;
+    }
+    zx0_stream_free(stream);
+
+    *output_size = output.size;
+    return output.data;
+}
+
@@ -0,0 +1,213 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "zx0.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_OFFSET 1
+#define MAX_GAMMA (1 << 30)
+
+/* the reader state lives in locals of zx0_decompress_into, running out of input fails the call */
+
+#define read_byte(v) \
+do { \
+    if (input_index >= input_size) \
+        return ZX0_ERROR_STREAM; \
+    v = input_data[input_index++]; \
+} while (0)
+
+#define read_bit(v) \
+do { \
+    if (backtrack) { \
+        backtrack = 0; \
+        v = input_data[input_index-1] & 1; \
+    } else { \
+        bit_mask >>= 1; \
+        if (!bit_mask) { \
+            bit_mask = 128; \
+            read_byte(bit_value); \
+        } \
+        v = bit_value & bit_mask ? 1 : 0; \
+    } \
+} while (0)
+
+#define read_interlaced_elias_gamma(v, h) \
+do { \
+    int b0; \
+    v = 1; \
+    for (;;) { \
+        read_bit(b0); \
+        if (b0 != backwards_mode) \
+            break; \
+        read_bit(b0); \
+        v = v << 1 | (b0 ^ (h)); \
+        if (v >= MAX_GAMMA) \
+            return ZX0_ERROR_STREAM; \
+    } \
+} while (0)
+
+/* copy a match forward, a word at a time when source and destination are far enough apart */
+static void copy_match(unsigned char *output_data, int offset, int length) {
+    const unsigned char *source = output_data-offset;
+
+    if (offset == 1) {
+        memset(output_data, *source, length);
+        return;
+    }
+    if (offset >= 8) {
+        while (length >= 8) {
+            memcpy(output_data, source, 8);
+            output_data += 8;
+            source += 8;
+            length -= 8;
+        }
+    }
+    while (length--) {
+        *output_data++ = *source++;
+    }
+}
+
+int zx0_decompress_into(const unsigned char *input_data, int input_size, unsigned char *output_data, int skip, int output_capacity, int backwards_mode, int invert_mode)
+{
+    int input_index = 0;
+    int output_index = skip;
+    int bit_mask = 0;
+    int bit_value = 0;
+    int backtrack = 0;
+    int last_offset = INITIAL_OFFSET;
+    int length;
+    int msb;
+    int lsb;
+    int bit;
+
+    backwards_mode = backwards_mode ? 1 : 0;
+    invert_mode = invert_mode ? 1 : 0;
+
+    for (;;) {
+        /* copy literals */
+        read_interlaced_elias_gamma(length, 0);
+        if (length > input_size-input_index) {
+            return ZX0_ERROR_STREAM;
+        }
+        if (length > output_capacity-output_index) {
+            return ZX0_ERROR_SPACE;
+        }
+        if (length < 8) {
+            /* short runs are the common case, not worth a call */
+            while (length--)
+                output_data[output_index++] = input_data[input_index++];
+        } else {
+            /* decompressing in place, the stream may still overlap the bytes written */
+            memmove(&output_data[output_index], &input_data[input_index], length);
+            input_index += length;
+            output_index += length;
+        }
+
+        read_bit(bit);
+        if (!bit) {
+            /* copy from last offset */
+            read_interlaced_elias_gamma(length, 0);
+            if (last_offset > output_index) {
+                return ZX0_ERROR_STREAM;
+            }
+            if (length > output_capacity-output_index) {
+                return ZX0_ERROR_SPACE;
+            }
+            copy_match(&output_data[output_index], last_offset, length);
+            output_index += length;
+
+            read_bit(bit);
+            if (!bit) {
+                continue;
+            }
+        }
+
+        /* copy from new offset, repeated while the next indicator asks for another one */
+        for (;;) {
+            read_interlaced_elias_gamma(msb, invert_mode);
+            if (msb == 256) {
+                return output_index-skip;
+            }
+            if (msb > 256) {
+                return ZX0_ERROR_STREAM;
+            }
+            read_byte(lsb);
+            if (backwards_mode)
+                last_offset = (msb-1)*128 + (lsb>>1) + 1;
+            else
+                last_offset = msb*128 - (lsb>>1);
+            backtrack = 1;
+            read_interlaced_elias_gamma(length, 0);
+            length++;
+            if (last_offset > output_index) {
+                return ZX0_ERROR_STREAM;
+            }
+            if (length > output_capacity-output_index) {
+                return ZX0_ERROR_SPACE;
+            }
+            copy_match(&output_data[output_index], last_offset, length);
+            output_index += length;
+
+            read_bit(bit);
+            if (!bit) {
+                break;
+            }
+        }
+    }
+}
+
+unsigned char *zx0_decompress(const unsigned char *input_data, int input_size, const unsigned char *prefix, int skip, int backwards_mode, int invert_mode, int *output_size)
+{
+    unsigned char *output_data;
+    int capacity = input_size*4 + 256;
+    int result;
+
+    /* grow until the whole stream fits */
+    for (;;) {
+        output_data = malloc(skip+capacity);
+        if (!output_data) {
+            return NULL;
+        }
+        if (skip) {
+            memcpy(output_data, prefix, skip);
+        }
+        result = zx0_decompress_into(input_data, input_size, output_data, skip, skip+capacity, backwards_mode, invert_mode);
+        if (result != ZX0_ERROR_SPACE || capacity > (1 << 29)) {
+            break;
+        }
+        free(output_data);
+        capacity *= 2;
+    }
+    if (result < 0) {
+        free(output_data);
+        return NULL;
+    }
+
+    memmove(output_data, output_data+skip, result);
+    *output_size = result;
+    return output_data;
+}
@@ -0,0 +1,97 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "zx0.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the tail of the prefix the offsets of the window can reach, which is all a compression ever reads of it */
+struct zx0_dictionary_t {
+    unsigned char *data;
+    int size;
+};
+
+zx0_DICTIONARY *zx0_dictionary_create(const unsigned char *prefix, int prefix_size, int window)
+{
+    zx0_DICTIONARY *dictionary;
+
+    if (prefix_size < 0) {
+        return NULL;
+    }
+    if (window <= 0 || window > ZX0_MAX_OFFSET) {
+        window = ZX0_MAX_OFFSET;
+    }
+
+    dictionary = calloc(1, sizeof(zx0_DICTIONARY));
+    if (!dictionary) {
+        return NULL;
+    }
+    dictionary->size = prefix_size < window ? prefix_size : window;
+    dictionary->data = malloc(dictionary->size ? dictionary->size : 1);
+    if (!dictionary->data) {
+        free(dictionary);
+        return NULL;
+    }
+    memcpy(dictionary->data, prefix + prefix_size - dictionary->size, dictionary->size);
+    return dictionary;
+}
+
+void zx0_dictionary_free(zx0_DICTIONARY *dictionary)
+{
+    if (!dictionary) {
+        return;
+    }
+    free(dictionary->data);
+    free(dictionary);
+}
+
+unsigned char *zx0_dictionary_compress(const zx0_DICTIONARY *dictionary, zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int backwards_mode, int invert_mode, int *output_size, int *delta, const zx0_OPTIONS *options)
+{
+    unsigned char *buffer;
+    unsigned char *output_data;
+
+    if (input_size < 1) {
+        return NULL;
+    }
+
+    /* the compressors read one buffer, so the asset goes right after the tail */
+    buffer = malloc(dictionary->size + input_size);
+    if (!buffer) {
+        return NULL;
+    }
+    memcpy(buffer, dictionary->data, dictionary->size);
+    memcpy(buffer + dictionary->size, input_data, input_size);
+
+    if (context) {
+        output_data = zx0_context_compress(context, buffer, dictionary->size + input_size, dictionary->size, backwards_mode, invert_mode, output_size, delta, NULL, options);
+    } else {
+        output_data = zx0_compress_ex(buffer, dictionary->size + input_size, dictionary->size, backwards_mode, invert_mode, output_size, delta, NULL, options);
+    }
+
+    free(buffer);
+    return output_data;
+}
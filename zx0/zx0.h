@@ -26,6 +26,256 @@
 #ifndef ZX0_H
 #define ZX0_H
 
+#include <stddef.h>
+
+/* memory for the block graph of the optimal parse, reusable between calls on the same thread */
+typedef struct zx0_arena_t zx0_ARENA;
+
+zx0_ARENA *zx0_arena_create(void);
+
+/* drop every block but keep the largest allocations for the next call */
+void zx0_arena_reset(zx0_ARENA *arena);
+
+/* most bytes the arena has held at once */
+size_t zx0_arena_high_water(const zx0_ARENA *arena);
+
+void zx0_arena_free(zx0_ARENA *arena);
+
+#define ZX0_MIN_LEVEL 1
+#define ZX0_MAX_LEVEL 9
+
+/* what a compression did, filled in when the options ask for it */
+typedef struct zx0_stats_t {
+    double optimize_seconds;    /* wall time of each phase */
+    double unreverse_seconds;
+    double encode_seconds;
+    long blocks_allocated;      /* blocks carved from the arena */
+    long blocks_recycled;       /* blocks reused after their last reference went away */
+    size_t arena_bytes;         /* peak arena memory of this call */
+    int budget_index;           /* where the quick parse took over once the budget ran out, -1 if it held */
+    int ceiling_index;          /* where the parse gave up, sure to exceed the ceiling, -1 if it did not */
+    int literal_runs;
+    int literal_bytes;
+    int repeat_matches;         /* copies from the last offset */
+    int new_matches;            /* copies from a new offset */
+    int match_bytes;
+    int literal_bits;           /* where the bits of the stream went, these add up to 8 times its size or less */
+    int flag_bits;
+    int length_bits;
+    int offset_bits;
+    int end_bits;
+    long decode_cycles;         /* estimated by the cycle model of the options, 0 without one */
+} zx0_STATS;
+
+/*
+ * What the target decompressor spends on each part of the stream, in cycles of its CPU. With a lambda
+ * in the options the optimal parse minimizes bits plus lambda times these cycles instead of bits alone,
+ * trading size for decoding speed (longer literal runs and fewer new offsets, mostly); the quick parse,
+ * the parse of streams and segmented compressions keep to bits. A weighted parse fails on inputs too
+ * long for its costs to fit an int: about 1M bytes with the Z80 model and a lambda of 0.1, 140K at 1.
+ */
+typedef struct zx0_cycles_t {
+    int literal;        /* per literal run, besides its bytes and length */
+    int literal_byte;
+    int repeat;         /* per copy from the last offset, besides its bytes and length */
+    int new_offset;     /* per copy from a new offset, its offset LSB included */
+    int copy_byte;      /* per byte of either copy */
+    int gamma_bit;      /* per bit of an Elias gamma code, lengths and offset MSBs alike */
+} zx0_CYCLES;
+
+/* fill cycles with about the T-states of the standard Z80 decompressor */
+void zx0_z80_cycles(zx0_CYCLES *cycles);
+
+typedef struct zx0_options_t {
+    int threads;        /* split the offset sweep across this many threads (0 or 1 is serial) */
+    int quick;          /* greedy hash chain parse instead of the optimal one, much faster but larger */
+    zx0_ARENA *arena;   /* block memory to reuse, NULL for a private arena per call */
+    int level;          /* ZX0_MIN_LEVEL to ZX0_MAX_LEVEL, overrides quick; 0 keeps the settings above */
+    int window;         /* largest offset to use, 0 for the one of the level (or the full 32640) */
+    int chain;          /* hash chain steps per position in the quick parse, 0 for the level default */
+    zx0_STATS *stats;   /* filled in by compressions and estimates (not streams), may be NULL */
+    double time_limit;  /* seconds the optimal parse may take before the quick parse finishes the input, 0 for no limit */
+    long work_limit;    /* offsets the optimal parse may sweep before the same (about 32640 per byte), 0 for no limit */
+    int segmented;      /* optimal parse in stream segments, memory near the window at any input size (no stats or limits) */
+    const zx0_CYCLES *cycles;   /* decoder model for the stats, and for the optimal parse with a lambda */
+    double lambda;      /* bits the optimal parse gives up per decode cycle saved, 0 for the smallest output */
+    const int *ceiling; /* an unweighted optimal parse fails once sure to take more bytes than this, which may drop meanwhile */
+} zx0_OPTIONS;
+
+/*
+ * Fill options with the parser, window and search effort of a compression level, leaving threads and
+ * arena alone. Levels 1-3 use the quick parse with growing chains, levels 4-9 the optimal parse with
+ * a window of 1024, 2048, 4096, 8192, 16384 and 32640 offsets; compression time is proportional to the
+ * window. Returns 0 for a level out of range.
+ */
+int zx0_level_options(int level, zx0_OPTIONS *options);
+
 unsigned char *zx0_compress(const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int));
 
+/* same output as zx0_compress, with the extra settings in options (may be NULL) */
+unsigned char *zx0_compress_ex(const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int), const zx0_OPTIONS *options);
+
+/*
+ * Every buffer zx0_compress_ex allocates besides the output, kept and reused from one call to the next.
+ * Contexts share nothing, so each thread compressing at the same time needs its own.
+ */
+typedef struct zx0_context_t zx0_CONTEXT;
+
+zx0_CONTEXT *zx0_context_create(void);
+
+/* same as zx0_compress_ex, the context arena holds the blocks unless options name another one */
+unsigned char *zx0_context_compress(zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, void (*progress)(int), const zx0_OPTIONS *options);
+
+void zx0_context_free(zx0_CONTEXT *context);
+
+typedef struct zx0_chunk_t {
+    unsigned char *output_data;
+    int output_size;
+    int input_offset;   /* first input byte this stream decodes */
+    int input_size;
+    int delta;
+} zx0_CHUNK;
+
+/*
+ * Compress input_data[skip..] as independent streams of chunk_size bytes each, on up to threads threads.
+ * Each stream may reference up to window bytes before its chunk (negative for the full zx0 window), so it
+ * decodes once the preceding data is in place. Release the result with zx0_free_chunks.
+ */
+zx0_CHUNK *zx0_compress_chunks(const unsigned char *input_data, int input_size, int skip, int chunk_size, int window, int backwards_mode, int invert_mode, int threads, int *nr_chunks);
+
+void zx0_free_chunks(zx0_CHUNK *chunks, int nr_chunks);
+
+/*
+ * Output size zx0_compress_ex would give with the same options, found without encoding, or -1 on failure.
+ * delta (may be NULL) receives its delta too, which is the same in every mode.
+ */
+int zx0_estimate(const unsigned char *input_data, int input_size, int skip, int *delta, const zx0_OPTIONS *options);
+
+int zx0_context_estimate(zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int *delta, const zx0_OPTIONS *options);
+
+/*
+ * Much faster estimate from the quick parse over the full window, for sorting out candidates. It is the size
+ * of a valid stream, so it is never below what the optimal parse over the full window gives (zx0_compress,
+ * or level 9); on text and tile data it came out 1.5-15% above that, and within 1.5% on data that hardly
+ * compresses. Levels with a smaller window or a shallower quick parse may well come out larger than it, as
+ * level 4 did at three times the size on data repeating from farther back than its window reaches.
+ */
+int zx0_estimate_quick(const unsigned char *input_data, int input_size, int skip, int *delta);
+
+typedef struct zx0_item_t {
+    const unsigned char *input_data;
+    int input_size;
+    int skip;
+    int backwards_mode;
+    int invert_mode;
+    const zx0_OPTIONS *options;     /* may be NULL */
+    unsigned char *output_data;     /* NULL if the item failed */
+    int output_size;
+    int delta;
+    double seconds;                 /* time spent compressing this item */
+} zx0_ITEM;
+
+/*
+ * Compress every item on up to threads threads, largest first, each thread reusing one context for all the
+ * items it takes. Items are dealt round robin to per-thread queues, and a thread that runs out steals from the
+ * others. done (may be NULL) is called for each finished item, one at a time. Returns the number of items that
+ * failed; the caller frees the output_data of the rest.
+ */
+int zx0_compress_batch(zx0_ITEM *items, int nr_items, int threads, void (*done)(void *user, zx0_ITEM *item), void *user);
+
+/*
+ * Compress data fed a piece at a time into a single zx0 stream, holding only a window of bytes already
+ * encoded and the ones still pending, so memory stays fixed whatever the input size. The optimal parse runs
+ * on segments of 32K, and the compressed bytes are handed to write once every chain of the parse still in
+ * contention goes through them, so the output matches a single parse. Should the chains not converge within 128K, the
+ * bytes before the last 1K are committed as the best parse has them.
+ * Options give the window, level and threads (the quick parse is not used). In backwards_mode the data must
+ * be fed already reversed, and the output reversed after the stream is flushed.
+ */
+typedef struct zx0_stream_t zx0_STREAM;
+
+zx0_STREAM *zx0_stream_create(int backwards_mode, int invert_mode, const zx0_OPTIONS *options, void (*write)(void *user, const unsigned char *output_data, int output_size), void *user);
+
+/* returns 0 on failure, which leaves the stream unusable */
+int zx0_stream_feed(zx0_STREAM *stream, const unsigned char *input_data, int input_size);
+
+/* encode the pending bytes and the end marker, returns 0 on failure or when nothing was fed */
+int zx0_stream_flush(zx0_STREAM *stream, int *delta);
+
+void zx0_stream_free(zx0_STREAM *stream);
+
+/* a span of target memory assets may decompress into */
+typedef struct zx0_region_t {
+    long address;
+    long size;
+} zx0_REGION;
+
+/* where an asset goes, each in a footprint of its own, so an overlay may decompress at any time */
+typedef struct zx0_placement_t {
+    int region;             /* index into the regions, -1 if the item failed or did not fit */
+    long output_address;    /* where it decompresses to */
+    long input_address;     /* where its stream is loaded, over the tail of the output (the head backwards) */
+    int footprint;          /* bytes of the region it takes, at least its size plus delta */
+} zx0_PLACEMENT;
+
+/*
+ * Compress items (without skip) on up to threads threads, then lay them out in regions to decompress in
+ * place, largest footprint first, each in the fullest region that still holds it. Every placement is checked
+ * by decompressing the stream over its own output in a scratch copy of its footprint. Backwards items are
+ * given reversed as usual, and their output reversed goes at input_address. Returns the number of items
+ * left unplaced; the caller frees the output_data of every item that has it.
+ */
+int zx0_plan_layout(zx0_ITEM *items, int nr_items, const zx0_REGION *regions, int nr_regions, int threads, zx0_PLACEMENT *placements);
+
+/*
+ * A prefix many inputs are compressed against, as with skip, prepared once. Only the last window bytes of
+ * the prefix (0 for the full 32640) can be referenced, so only those are kept, and the cost of each input
+ * no longer grows with the prefix. The output is the same as compressing prefix and input together with
+ * skip at the end of the prefix, when the window covers the one of the options, and it decompresses with
+ * the whole prefix (or just its tail) in front. A dictionary is only read, so threads may share it.
+ */
+typedef struct zx0_dictionary_t zx0_DICTIONARY;
+
+zx0_DICTIONARY *zx0_dictionary_create(const unsigned char *prefix, int prefix_size, int window);
+
+void zx0_dictionary_free(zx0_DICTIONARY *dictionary);
+
+/* compress input_data after the dictionary, through context (may be NULL) with options (may be NULL) */
+unsigned char *zx0_dictionary_compress(const zx0_DICTIONARY *dictionary, zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int backwards_mode, int invert_mode, int *output_size, int *delta, const zx0_OPTIONS *options);
+
+/*
+ * Persistent cache of compressed outputs in the directory path, created if missing. Entries are keyed by a
+ * hash of the input and of the skip, modes, options and cache version, and hold the output and its delta, so
+ * an unchanged asset is never compressed twice. Several threads or processes may share a cache directory;
+ * entries are written whole and renamed into place. Compressions with a time_limit bypass the cache.
+ */
+typedef struct zx0_cache_t zx0_CACHE;
+
+zx0_CACHE *zx0_cache_open(const char *path);
+
+void zx0_cache_close(zx0_CACHE *cache);
+
+/* same as zx0_context_compress (or zx0_compress_ex when context is NULL), through the cache */
+unsigned char *zx0_cache_compress(zx0_CACHE *cache, zx0_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta, const zx0_OPTIONS *options);
+
+/*
+ * Same as zx0_compress_batch through the cache. Identical items in the batch are looked up and compressed
+ * once, and the rest get copies; items found in the cache report 0 seconds. done gets the items found in the
+ * cache first, then each compressed one as it finishes, then the copies.
+ */
+int zx0_cache_compress_batch(zx0_CACHE *cache, zx0_ITEM *items, int nr_items, int threads, void (*done)(void *user, zx0_ITEM *item), void *user);
+
+#define ZX0_ERROR_STREAM -1
+#define ZX0_ERROR_SPACE -2
+
+/*
+ * Decompress a stream from zx0_compress into output_data[skip..output_capacity-1], where the first skip bytes
+ * already hold the prefix it was compressed against. Returns the number of bytes written after the prefix,
+ * ZX0_ERROR_STREAM for a malformed stream or ZX0_ERROR_SPACE if output_capacity is too small.
+ */
+int zx0_decompress_into(const unsigned char *input_data, int input_size, unsigned char *output_data, int skip, int output_capacity, int backwards_mode, int invert_mode);
+
+/* same as zx0_decompress_into, allocating the output (without the prefix, which may be NULL when skip is 0) */
+unsigned char *zx0_decompress(const unsigned char *input_data, int input_size, const unsigned char *prefix, int skip, int backwards_mode, int invert_mode, int *output_size);
+
 #endif
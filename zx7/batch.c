@@ -0,0 +1,226 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ * Copyright 2017-2025 Matt "MateoConLechuga" Waltz (multithread support)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "zx7.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef ZX7_NO_THREADS
+#include <pthread.h>
+#endif
+
+/* the items dealt to one worker, largest first; the owner takes from the head and thieves from the tail */
+typedef struct zx7_queue_t {
+    zx7_ITEM **items;
+    int head;
+    int tail;
+#ifndef ZX7_NO_THREADS
+    pthread_mutex_t lock;
+#endif
+} zx7_QUEUE;
+
+typedef struct zx7_batch_t {
+    zx7_QUEUE queues[ZX7_MAX_THREADS];
+    int nr_queues;
+    int failed;
+    void (*done)(void *user, zx7_ITEM *item);
+    void *user;
+#ifndef ZX7_NO_THREADS
+    pthread_mutex_t done_lock;
+#endif
+} zx7_BATCH;
+
+typedef struct zx7_batch_worker_t {
+    zx7_BATCH *batch;
+    int id;
+} zx7_BATCH_WORKER;
+
+/* compression time is proportional to the bytes encoded, so those decide the order */
+static int zx7_larger_first(const void *a, const void *b) {
+    const zx7_ITEM *x = *(zx7_ITEM * const *)a;
+    const zx7_ITEM *y = *(zx7_ITEM * const *)b;
+    int x_size = x->input_size - x->skip;
+    int y_size = y->input_size - y->skip;
+
+    return (y_size > x_size) - (y_size < x_size);
+}
+
+static zx7_ITEM *zx7_take(zx7_QUEUE *queue, int steal) {
+    zx7_ITEM *item = NULL;
+
+#ifndef ZX7_NO_THREADS
+    pthread_mutex_lock(&queue->lock);
+#endif
+    if (queue->head < queue->tail) {
+        item = steal ? queue->items[--queue->tail] : queue->items[queue->head++];
+    }
+#ifndef ZX7_NO_THREADS
+    pthread_mutex_unlock(&queue->lock);
+#endif
+    return item;
+}
+
+static double zx7_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+static void *zx7_batch_worker(void *arg) {
+    zx7_BATCH_WORKER *worker = arg;
+    zx7_BATCH *batch = worker->batch;
+    zx7_CONTEXT *context;
+    zx7_ITEM *item;
+    double start;
+    int i;
+
+    /* one context per worker, reused for all the items it takes */
+    context = zx7_context_create();
+    for (;;) {
+        /* own items first, then the smallest leftovers of the others */
+        item = zx7_take(&batch->queues[worker->id], 0);
+        for (i = 1; !item && i < batch->nr_queues; i++) {
+            item = zx7_take(&batch->queues[(worker->id+i) % batch->nr_queues], 1);
+        }
+        if (!item) {
+            break;
+        }
+
+        start = zx7_seconds();
+        item->output_data = NULL;
+        if (context) {
+            zx7_context_cost_model(context, item->cycles, item->lambda);
+            item->output_data = zx7_context_compress(context, item->input_data, item->input_size, item->skip,
+                                                     &item->output_size, &item->delta);
+        }
+        item->seconds = zx7_seconds()-start;
+        if (!item->output_data) {
+            __atomic_add_fetch(&batch->failed, 1, __ATOMIC_RELAXED);
+        }
+        if (batch->done) {
+#ifndef ZX7_NO_THREADS
+            pthread_mutex_lock(&batch->done_lock);
+#endif
+            batch->done(batch->user, item);
+#ifndef ZX7_NO_THREADS
+            pthread_mutex_unlock(&batch->done_lock);
+#endif
+        }
+    }
+    zx7_context_free(context);
+
+    return NULL;
+}
+
+int zx7_compress_batch(zx7_ITEM *items, int nr_items, int threads, void (*done)(void *user, zx7_ITEM *item), void *user)
+{
+    zx7_BATCH batch;
+    zx7_BATCH_WORKER workers[ZX7_MAX_THREADS];
+    zx7_ITEM **order;
+    zx7_ITEM **dealt;
+#ifndef ZX7_NO_THREADS
+    pthread_t thread[ZX7_MAX_THREADS];
+    int started = 0;
+#endif
+    int first;
+    int i;
+    int j;
+
+    if (nr_items <= 0) {
+        return 0;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > ZX7_MAX_THREADS) {
+        threads = ZX7_MAX_THREADS;
+    }
+    if (threads > nr_items) {
+        threads = nr_items;
+    }
+#ifdef ZX7_NO_THREADS
+    threads = 1;
+#endif
+
+    order = malloc(2 * nr_items * sizeof(zx7_ITEM *));
+    if (!order) {
+        return nr_items;
+    }
+    dealt = order + nr_items;
+    for (i = 0; i < nr_items; i++) {
+        order[i] = &items[i];
+    }
+    qsort(order, nr_items, sizeof(zx7_ITEM *), zx7_larger_first);
+
+    /* deal the items round robin, so every queue starts with one of the largest */
+    memset(&batch, 0, sizeof batch);
+    batch.nr_queues = threads;
+    batch.done = done;
+    batch.user = user;
+#ifndef ZX7_NO_THREADS
+    pthread_mutex_init(&batch.done_lock, NULL);
+#endif
+    for (first = 0, i = 0; i < threads; i++) {
+        batch.queues[i].items = &dealt[first];
+        for (j = i; j < nr_items; j += threads) {
+            dealt[first++] = order[j];
+        }
+        batch.queues[i].tail = &dealt[first] - batch.queues[i].items;
+#ifndef ZX7_NO_THREADS
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+#endif
+        workers[i].batch = &batch;
+        workers[i].id = i;
+    }
+
+#ifndef ZX7_NO_THREADS
+    /* the calling thread is worker 0, a worker that fails to start leaves its queue to the thieves */
+    for (i = 1; i < threads; i++) {
+        if (!pthread_create(&thread[started], NULL, zx7_batch_worker, &workers[i])) {
+            started++;
+        }
+    }
+    zx7_batch_worker(&workers[0]);
+    for (i = 0; i < started; i++) {
+        pthread_join(thread[i], NULL);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    pthread_mutex_destroy(&batch.done_lock);
+#else
+    zx7_batch_worker(&workers[0]);
+#endif
+
+    free(order);
+    return batch.failed;
+}
@@ -0,0 +1,467 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "zx7.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+/* plain stdio for the entries, only making a directory and naming temporaries differ between hosts */
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define zx7_mkdir(path) _mkdir(path)
+#define zx7_getpid() _getpid()
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#define zx7_mkdir(path) mkdir(path, 0777)
+#define zx7_getpid() getpid()
+#endif
+
+#define ZX7_CACHE_VERSION 2
+#define ZX7_CACHE_MAGIC "ZX7C"
+
+/*
+ * Entries live in their own files under the cache directory, named after the 128-bit hash of the input and
+ * of every parameter that changes the output. They are written to a temporary file and renamed into place,
+ * so readers in other threads or processes only ever see complete entries.
+ */
+struct zx7_cache_t {
+    char *path;
+    int temporaries;
+};
+
+/* entries start with the magic, then the version, input size, output size and delta in little endian */
+#define ZX7_CACHE_HEADER_SIZE 24
+
+typedef struct zx7_key_t {
+    uint64_t hash[2];
+} zx7_KEY;
+
+/* size bytes of value in little endian, so keys and entries mean the same on every host */
+static void zx7_put(unsigned char *data, uint64_t value, int size) {
+    int i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = (unsigned char)(value >> (i*8));
+    }
+}
+
+static uint64_t zx7_get(const unsigned char *data, int size) {
+    uint64_t value = 0;
+    int i;
+
+    for (i = size-1; i >= 0; i--) {
+        value = value << 8 | data[i];
+    }
+    return value;
+}
+
+static uint64_t zx7_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t zx7_fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* MurmurHash3 x64 128 */
+static void zx7_hash(const unsigned char *data, size_t size, uint64_t seed, uint64_t hash[2]) {
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    uint64_t k1;
+    uint64_t k2;
+    size_t i;
+    int j;
+
+    for (i = 0; i+16 <= size; i += 16) {
+        memcpy(&k1, data+i, 8);
+        memcpy(&k2, data+i+8, 8);
+        k1 *= c1; k1 = zx7_rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = zx7_rotl(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+        k2 *= c2; k2 = zx7_rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = zx7_rotl(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+    }
+
+    /* the tail, byte by byte so the result does not depend on the byte order */
+    k1 = 0;
+    k2 = 0;
+    for (j = (int)(size-i)-1; j >= 8; j--) {
+        k2 ^= (uint64_t)data[i+j] << ((j-8)*8);
+    }
+    for (j = (int)(size-i) < 8 ? (int)(size-i)-1 : 7; j >= 0; j--) {
+        k1 ^= (uint64_t)data[i+j] << (j*8);
+    }
+    if (size-i > 8) {
+        k2 *= c2; k2 = zx7_rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    if (size-i > 0) {
+        k1 *= c1; k1 = zx7_rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+    h1 += h2;
+    h2 += h1;
+    h1 = zx7_fmix(h1);
+    h2 = zx7_fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    hash[0] = h1;
+    hash[1] = h2;
+}
+
+/* every parameter takes 8 bytes in little endian, lambda its exact bits */
+static void zx7_make_key(const zx7_ITEM *item, zx7_KEY *key) {
+    long long values[9];
+    unsigned char parameters[9*8];
+    uint64_t input[2];
+    double lambda;
+    int i;
+
+    memset(values, 0, sizeof values);
+    values[0] = ZX7_CACHE_VERSION;
+    values[1] = item->input_size;
+    values[2] = item->skip;
+    /* the cycle model only changes the output along with a lambda */
+    if (item->cycles != NULL && item->lambda > 0) {
+        values[3] = item->cycles->literal;
+        values[4] = item->cycles->match;
+        values[5] = item->cycles->long_offset;
+        values[6] = item->cycles->copy_byte;
+        values[7] = item->cycles->gamma_bit;
+        lambda = item->lambda;
+        memcpy(&values[8], &lambda, sizeof lambda);
+    }
+    for (i = 0; i < 9; i++) {
+        zx7_put(parameters+i*8, (uint64_t)values[i], 8);
+    }
+
+    zx7_hash(item->input_data, item->input_size, 0, input);
+    zx7_hash(parameters, sizeof parameters, input[0] ^ zx7_rotl(input[1], 32), key->hash);
+}
+
+/* entry file name, with the first byte of the hash as a subdirectory; dir gets the subdirectory alone */
+static char *zx7_entry_path(zx7_CACHE *cache, const zx7_KEY *key, char **dir) {
+    size_t length = strlen(cache->path);
+    char *name;
+
+    name = malloc(length+36);
+    if (name == NULL) {
+        return NULL;
+    }
+    sprintf(name, "%s/%02x/%014llx%016llx", cache->path, (unsigned)(key->hash[0] >> 56),
+            (unsigned long long)(key->hash[0] & 0xffffffffffffffULL), (unsigned long long)key->hash[1]);
+    if (dir != NULL) {
+        *dir = malloc(length+4);
+        if (*dir == NULL) {
+            free(name);
+            return NULL;
+        }
+        memcpy(*dir, name, length+3);
+        (*dir)[length+3] = 0;
+    }
+    return name;
+}
+
+zx7_CACHE *zx7_cache_open(const char *path) {
+    zx7_CACHE *cache;
+
+    if (zx7_mkdir(path) && errno != EEXIST) {
+        return NULL;
+    }
+    cache = calloc(1, sizeof(zx7_CACHE));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->path = malloc(strlen(path)+1);
+    if (cache->path == NULL) {
+        free(cache);
+        return NULL;
+    }
+    strcpy(cache->path, path);
+    return cache;
+}
+
+void zx7_cache_close(zx7_CACHE *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    free(cache->path);
+    free(cache);
+}
+
+/* read the entry of key; returns 0 when there is no valid entry */
+static int zx7_cache_load(zx7_CACHE *cache, const zx7_KEY *key, zx7_ITEM *item) {
+    unsigned char header[ZX7_CACHE_HEADER_SIZE];
+    unsigned char *output_data;
+    int output_size;
+    char *name;
+    FILE *file;
+    int found = 0;
+
+    name = zx7_entry_path(cache, key, NULL);
+    if (name == NULL) {
+        return 0;
+    }
+    file = fopen(name, "rb");
+    free(name);
+    if (file == NULL) {
+        return 0;
+    }
+    if (fread(header, sizeof header, 1, file) == 1) {
+        output_size = (int)zx7_get(header+12, 4);
+        if (!memcmp(header, ZX7_CACHE_MAGIC, 4) && zx7_get(header+4, 4) == ZX7_CACHE_VERSION &&
+            (int)zx7_get(header+8, 4) == item->input_size && output_size > 0) {
+            output_data = malloc(output_size);
+            /* the output has to fill the rest of the entry exactly */
+            if (output_data != NULL && fread(output_data, output_size, 1, file) == 1 && fgetc(file) == EOF) {
+                item->output_data = output_data;
+                item->output_size = output_size;
+                item->delta = (long)(int64_t)zx7_get(header+16, 8);
+                item->seconds = 0;
+                found = 1;
+            } else {
+                free(output_data);
+            }
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+/* failing to store only costs the next build a compression, so errors are ignored */
+static void zx7_cache_store(zx7_CACHE *cache, const zx7_KEY *key, const zx7_ITEM *item) {
+    unsigned char header[ZX7_CACHE_HEADER_SIZE];
+    char *dir;
+    char *name;
+    char *temporary;
+    FILE *file;
+    int written;
+
+    name = zx7_entry_path(cache, key, &dir);
+    if (name == NULL) {
+        return;
+    }
+    temporary = malloc(strlen(dir)+48);
+    if (temporary != NULL && (!zx7_mkdir(dir) || errno == EEXIST)) {
+        sprintf(temporary, "%s/.tmp.%ld.%d", dir, (long)zx7_getpid(), __atomic_fetch_add(&cache->temporaries, 1, __ATOMIC_RELAXED));
+        file = fopen(temporary, "wb");
+        if (file != NULL) {
+            memcpy(header, ZX7_CACHE_MAGIC, 4);
+            zx7_put(header+4, ZX7_CACHE_VERSION, 4);
+            zx7_put(header+8, (uint64_t)item->input_size, 4);
+            zx7_put(header+12, (uint64_t)item->output_size, 4);
+            zx7_put(header+16, (uint64_t)item->delta, 8);
+            written = fwrite(header, sizeof header, 1, file) == 1 &&
+                      fwrite(item->output_data, item->output_size, 1, file) == 1;
+            if (fclose(file) || !written || rename(temporary, name)) {
+                remove(temporary);
+            }
+        }
+    }
+    free(temporary);
+    free(dir);
+    free(name);
+}
+
+unsigned char *zx7_cache_compress(zx7_CACHE *cache, zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int *output_size, long *delta)
+{
+    zx7_ITEM item;
+    zx7_KEY key;
+    zx7_CYCLES cycles;
+
+    memset(&item, 0, sizeof item);
+    item.input_data = input_data;
+    item.input_size = input_size;
+    item.skip = skip;
+    if (context != NULL) {
+        item.lambda = zx7_context_lambda(context, &cycles);
+        item.cycles = item.lambda > 0 ? &cycles : NULL;
+    }
+    zx7_make_key(&item, &key);
+
+    if (!zx7_cache_load(cache, &key, &item)) {
+        if (context != NULL) {
+            item.output_data = zx7_context_compress(context, input_data, input_size, skip, &item.output_size, &item.delta);
+        } else {
+            item.output_data = zx7_compress(input_data, input_size, skip, &item.output_size, &item.delta);
+        }
+        if (item.output_data == NULL) {
+            return NULL;
+        }
+        zx7_cache_store(cache, &key, &item);
+    }
+
+    *output_size = item.output_size;
+    *delta = item.delta;
+    return item.output_data;
+}
+
+typedef struct zx7_cache_slot_t {
+    zx7_KEY key;
+    int index;
+} zx7_CACHE_SLOT;
+
+static int zx7_same_key(const zx7_KEY *a, const zx7_KEY *b) {
+    return a->hash[0] == b->hash[0] && a->hash[1] == b->hash[1];
+}
+
+static int zx7_key_order(const void *a, const void *b) {
+    const zx7_CACHE_SLOT *x = a;
+    const zx7_CACHE_SLOT *y = b;
+
+    if (x->key.hash[0] != y->key.hash[0]) {
+        return x->key.hash[0] < y->key.hash[0] ? -1 : 1;
+    }
+    if (x->key.hash[1] != y->key.hash[1]) {
+        return x->key.hash[1] < y->key.hash[1] ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/* what the misses of a batch need to reach their item as each one finishes */
+typedef struct zx7_cache_batch_t {
+    zx7_CACHE *cache;
+    zx7_ITEM *items;
+    zx7_ITEM *misses;
+    const zx7_CACHE_SLOT *slots;
+    const int *origin;
+    void (*done)(void *user, zx7_ITEM *item);
+    void *user;
+} zx7_CACHE_BATCH;
+
+/* called one miss at a time by the batch, which stores it and hands it on right away */
+static void zx7_cache_done(void *user, zx7_ITEM *item) {
+    zx7_CACHE_BATCH *batch = user;
+    const zx7_CACHE_SLOT *slot = &batch->slots[batch->origin[item-batch->misses]];
+    zx7_ITEM *original = &batch->items[slot->index];
+
+    *original = *item;
+    if (original->output_data != NULL) {
+        zx7_cache_store(batch->cache, &slot->key, original);
+    }
+    if (batch->done != NULL) {
+        batch->done(batch->user, original);
+    }
+}
+
+int zx7_cache_compress_batch(zx7_CACHE *cache, zx7_ITEM *items, int nr_items, int threads, void (*done)(void *user, zx7_ITEM *item), void *user)
+{
+    zx7_CACHE_BATCH batch;
+    zx7_CACHE_SLOT *slots;
+    zx7_ITEM *misses;
+    int *origin;
+    int *first;
+    int nr_misses = 0;
+    int failed = 0;
+    int i;
+    int j;
+
+    if (nr_items <= 0) {
+        return 0;
+    }
+    slots = malloc(nr_items * sizeof(zx7_CACHE_SLOT));
+    misses = malloc(nr_items * sizeof(zx7_ITEM));
+    origin = malloc(nr_items * sizeof(int));
+    first = malloc(nr_items * sizeof(int));
+    if (slots == NULL || misses == NULL || origin == NULL || first == NULL) {
+        free(slots);
+        free(misses);
+        free(origin);
+        free(first);
+        return nr_items;
+    }
+
+    /* identical items sort next to each other, and only the first of them is looked up or compressed */
+    for (i = 0; i < nr_items; i++) {
+        zx7_make_key(&items[i], &slots[i].key);
+        slots[i].index = i;
+        items[i].output_data = NULL;
+    }
+    qsort(slots, nr_items, sizeof(zx7_CACHE_SLOT), zx7_key_order);
+    for (i = 0; i < nr_items; i++) {
+        j = slots[i].index;
+        if (i && zx7_same_key(&slots[i-1].key, &slots[i].key)) {
+            first[j] = first[slots[i-1].index];
+            continue;
+        }
+        first[j] = j;
+        if (!zx7_cache_load(cache, &slots[i].key, &items[j])) {
+            misses[nr_misses] = items[j];
+            origin[nr_misses++] = i;
+        } else if (done != NULL) {
+            done(user, &items[j]);
+        }
+    }
+
+    /* misses are stored and handed on as they finish, duplicates once all of them have */
+    batch.cache = cache;
+    batch.items = items;
+    batch.misses = misses;
+    batch.slots = slots;
+    batch.origin = origin;
+    batch.done = done;
+    batch.user = user;
+    zx7_compress_batch(misses, nr_misses, threads, zx7_cache_done, &batch);
+
+    /* duplicates get copies of the first output */
+    for (i = 0; i < nr_items; i++) {
+        if (first[i] != i && items[first[i]].output_data != NULL) {
+            items[i].output_data = malloc(items[first[i]].output_size);
+            if (items[i].output_data != NULL) {
+                memcpy(items[i].output_data, items[first[i]].output_data, items[first[i]].output_size);
+                items[i].output_size = items[first[i]].output_size;
+                items[i].delta = items[first[i]].delta;
+                items[i].seconds = 0;
+            }
+        }
+        if (items[i].output_data == NULL) {
+            failed++;
+        }
+        if (first[i] != i && done != NULL) {
+            done(user, &items[i]);
+        }
+    }
+
+    free(slots);
+    free(misses);
+    free(origin);
+    free(first);
+    return failed;
+}
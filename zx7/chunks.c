@@ -0,0 +1,155 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ * Copyright 2017-2025 Matt "MateoConLechuga" Waltz (multithread support)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "zx7.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ZX7_NO_THREADS
+#include <pthread.h>
+#endif
+
+typedef struct zx7_chunk_job_t {
+    const unsigned char *input_data;
+    int skip;
+    int chunk_size;
+    int window;
+    int nr_chunks;
+    int next;
+    int failed;
+    zx7_CHUNK *chunks;
+} zx7_CHUNK_JOB;
+
+static int zx7_compress_chunk(zx7_CHUNK_JOB *job, zx7_CONTEXT *context, int i) {
+    zx7_CHUNK *chunk = &job->chunks[i];
+    int window = chunk->input_offset < job->window ? chunk->input_offset : job->window;
+
+    /* the bytes before the chunk are only referenced, never encoded */
+    chunk->output_data = zx7_context_compress(context, job->input_data + chunk->input_offset - window, chunk->input_size + window, window,
+                                              &chunk->output_size, &chunk->delta);
+    return chunk->output_data != NULL;
+}
+
+static void *zx7_chunk_worker(void *arg) {
+    zx7_CHUNK_JOB *job = arg;
+    zx7_CONTEXT *context;
+    int i;
+
+    /* one context per worker, reused for all the chunks it takes */
+    context = zx7_context_create();
+    if (!context) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->nr_chunks) {
+        if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (!zx7_compress_chunk(job, context, i)) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    zx7_context_free(context);
+
+    return NULL;
+}
+
+zx7_CHUNK *zx7_compress_chunks(const unsigned char *input_data, int input_size, int skip, int chunk_size, int window, int threads, int *nr_chunks)
+{
+    zx7_CHUNK_JOB job;
+#ifndef ZX7_NO_THREADS
+    pthread_t thread[ZX7_MAX_THREADS];
+    int started = 0;
+#endif
+    int i;
+
+    if (skip < 0 || skip >= input_size || chunk_size < 1) {
+        return NULL;
+    }
+    if (window < 0 || window > MAX_OFFSET) {
+        window = MAX_OFFSET;
+    }
+
+    memset(&job, 0, sizeof job);
+    job.input_data = input_data;
+    job.skip = skip;
+    job.chunk_size = chunk_size;
+    job.window = window;
+    job.nr_chunks = (input_size-skip+chunk_size-1)/chunk_size;
+
+    job.chunks = calloc(job.nr_chunks, sizeof(zx7_CHUNK));
+    if (!job.chunks) {
+        return NULL;
+    }
+    for (i = 0; i < job.nr_chunks; i++) {
+        job.chunks[i].input_offset = skip + i*chunk_size;
+        job.chunks[i].input_size = i == job.nr_chunks-1 ? input_size - job.chunks[i].input_offset : chunk_size;
+    }
+
+#ifndef ZX7_NO_THREADS
+    if (threads > ZX7_MAX_THREADS) {
+        threads = ZX7_MAX_THREADS;
+    }
+    if (threads > job.nr_chunks) {
+        threads = job.nr_chunks;
+    }
+    /* the calling thread is one of the workers */
+    for (; started < threads-1; started++) {
+        if (pthread_create(&thread[started], NULL, zx7_chunk_worker, &job)) {
+            break;
+        }
+    }
+    zx7_chunk_worker(&job);
+    for (i = 0; i < started; i++) {
+        pthread_join(thread[i], NULL);
+    }
+#else
+    (void)threads;
+    zx7_chunk_worker(&job);
+#endif
+
+    if (job.failed) {
+        zx7_free_chunks(job.chunks, job.nr_chunks);
+        return NULL;
+    }
+
+    *nr_chunks = job.nr_chunks;
+    return job.chunks;
+}
+
+void zx7_free_chunks(zx7_CHUNK *chunks, int nr_chunks)
+{
+    int i;
+
+    if (!chunks) {
+        return;
+    }
+    for (i = 0; i < nr_chunks; i++) {
+        free(chunks[i].output_data);
+    }
+    free(chunks);
+}
@@ -24,135 +24,920 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "zx7.h"
+#include "internal.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
+
+#ifndef ZX7_NO_THREADS
+#include <pthread.h>
+#endif
 
-#define MAX_OFFSET  2176  /* range 1..2176 */
 #define MAX_LEN    65536  /* range 2..65536 */
 
 typedef struct zx7_optimal_t {
-    int bits;
+    int bits;                   /* cost of the parse up to here, in bits unless a cost model weighs in cycles */
     int offset;
     int len;
 } zx7_Optimal;
 
+/* a match ending at the current position, finders report them by ascending offset and length */
+typedef struct zx7_match_t {
+    int offset;
+    int len;
+} zx7_Match;
+
+typedef struct zx7_finder_t zx7_Finder;
+
+/*
+ * A match finder is started on each input, then indexes every position from 1 on, in order. find() adds
+ * index and stores in matches the smallest offset reaching each length, up to limit, returning how many
+ * matches it stored.
+ */
+struct zx7_finder_t {
+    int (*start)(zx7_Finder *finder, const unsigned char *input_data, int input_size);
+    int (*find)(zx7_Finder *finder, int index, int limit, zx7_Match *matches);
+    void (*destroy)(zx7_Finder *finder);
+    const unsigned char *input_data;
+    int min[MAX_OFFSET+1];      /* positions min..max are known to match at this offset */
+    int max[MAX_OFFSET+1];
+    int *heads;                 /* latest position of each 2-byte key */
+    int *links;
+    int capacity;               /* positions links can hold */
+    int base;                   /* tree position of index 0 of the current input */
+    int end;
+    long steps;                 /* chain or tree nodes visited */
+};
+
+static void zx7_forget(zx7_Finder *finder, const unsigned char *input_data) {
+    int offset;
+
+    finder->input_data = input_data;
+    finder->steps = 0;
+    for (offset = 0; offset <= MAX_OFFSET; offset++) {
+        finder->max[offset] = -1;
+    }
+}
+
 static int count_bits(int offset, int len) {
     return (((sizeof(int)*CHAR_BIT+4) - __builtin_clz(len-1)) << 1) + ((128 - offset) >> (sizeof(int)*CHAR_BIT-1) & 4);
 }
 
-static zx7_Optimal *zx7_optimize(const unsigned char *input_data, int input_size, int skip) {
-    int min[MAX_OFFSET+1];
-    int max[MAX_OFFSET+1];
-    int matches[256*256];
-    int *match_slots = NULL;
-    zx7_Optimal *optimal = NULL;
+/*
+ * Costs of the tokens. Without a lambda these are bits, with one COST_SCALE per bit plus COST_SCALE*lambda
+ * per cycle, rounded; match, long_offset, copy_byte and gamma_bit then add the cycles of a copy to the bits
+ * count_bits gives.
+ */
+typedef struct zx7_cost_t {
+    int weighted;
+    int bit;
+    int literal;                /* literal byte and its indicator */
+    int match;
+    int long_offset;
+    int copy_byte;
+    int gamma_bit;
+} zx7_Cost;
+
+#define COST_SCALE 32
+
+static int zx7_match_cost(const zx7_Cost *cost, int offset, int len) {
+    if (!cost->weighted) {
+        return count_bits(offset, len);
+    }
+    return cost->bit*count_bits(offset, len) + cost->match + (offset > 128 ? cost->long_offset : 0) + len*cost->copy_byte +
+           cost->gamma_bit*(((sizeof(int)*CHAR_BIT-1) - __builtin_clz(len-1))*2+1);
+}
+
+/* length of the match ending at index, assuming its first len bytes match already */
+static int zx7_match_length(zx7_Finder *finder, int index, int offset, int len, int limit) {
+    const unsigned char *input_data = finder->input_data;
+
+    while (len < limit && index-len >= offset && input_data[index-len] == input_data[index-len-offset]) {
+        len++;
+        if (index-len >= finder->min[offset] && index-len <= finder->max[offset]) {
+            len = index+1-finder->min[offset];
+            if (len > limit) {
+                len = limit;
+            }
+        }
+    }
+    if (len > 0) {
+        finder->min[offset] = index+1-len;
+        finder->max[offset] = index;
+    }
+    return len;
+}
+
+static int zx7_chain_start(zx7_Finder *finder, const unsigned char *input_data, int input_size) {
+    if (finder->capacity < input_size) {
+        free(finder->links);
+        finder->capacity = 0;
+        finder->links = malloc(input_size*sizeof(int));
+        if (finder->links == NULL) {
+            return 0;
+        }
+        finder->capacity = input_size;
+    }
+    zx7_forget(finder, input_data);
+    memset(finder->heads, 0, 256*256*sizeof(int));
+    return 1;
+}
+
+/* walk the positions sharing the last 2 bytes, newest first */
+static int zx7_chain_find(zx7_Finder *finder, int index, int limit, zx7_Match *matches) {
+    int key = finder->input_data[index-1] << 8 | finder->input_data[index];
     int *match;
-    int match_index;
     int offset;
     int len;
-    int best_len;
+    int best_len = 1;
+    int count = 0;
+
+    for (match = &finder->heads[key]; *match != 0 && best_len < limit; match = &finder->links[*match]) {
+        offset = index - *match;
+        if (offset > MAX_OFFSET) {
+            *match = 0;
+            break;
+        }
+        finder->steps++;
+        len = zx7_match_length(finder, index, offset, 2, limit);
+        if (len > best_len) {
+            best_len = len;
+            matches[count].offset = offset;
+            matches[count++].len = len;
+        }
+    }
+    finder->links[index] = finder->heads[key];
+    finder->heads[key] = index;
+    return count;
+}
+
+/*
+ * Positions sharing the last 2 bytes also form a binary search tree, ordered by the bytes that precede
+ * them and rebuilt from the new position as root each time, so every node is newer than its children.
+ * The newest position matching the current one for a given length is then always on its search path,
+ * which is walked in the same offset order as a hash chain, but without visiting the rest of the chain.
+ * Nodes live in a cyclic buffer of 2 links per position, and the ones beyond MAX_OFFSET are cut off.
+ */
+#define TREE_SIZE (MAX_OFFSET+1)
+
+/*
+ * Tree positions keep growing from one input to the next, leaving a gap wider than MAX_OFFSET, so nodes
+ * of earlier inputs are cut off like any other old node and the roots only need clearing on wrap around.
+ */
+static int zx7_tree_start(zx7_Finder *finder, const unsigned char *input_data, int input_size) {
+    zx7_forget(finder, input_data);
+    if (finder->end > INT_MAX-TREE_SIZE-input_size) {
+        memset(finder->heads, -1, 256*256*sizeof(int));
+        finder->end = 0;
+    }
+    finder->base = finder->end+TREE_SIZE;
+    finder->end = finder->base+input_size;
+    return 1;
+}
+
+static int zx7_tree_find(zx7_Finder *finder, int index, int limit, zx7_Match *matches) {
+    const unsigned char *input_data = finder->input_data;
+    int key = input_data[index-1] << 8 | input_data[index];
+    int position = finder->base+index;
+    int *smaller = &finder->links[position % TREE_SIZE * 2];
+    int *larger = smaller+1;
+    int *pair;
+    int node = finder->heads[key];
+    int smaller_len = 2;
+    int larger_len = 2;
+    int offset;
+    int len;
+    int best_len = 1;
+    int count = 0;
+
+    finder->heads[key] = position;
+    for (;;) {
+        offset = position - node;
+        if (node < 0 || offset > MAX_OFFSET) {
+            *smaller = *larger = -1;
+            break;
+        }
+        pair = &finder->links[node % TREE_SIZE * 2];
+        finder->steps++;
+        len = zx7_match_length(finder, index, offset, smaller_len < larger_len ? smaller_len : larger_len, MAX_LEN);
+        if (len > best_len && best_len < limit) {
+            best_len = len;
+            matches[count].offset = offset;
+            matches[count++].len = len < limit ? len : limit;
+        }
+        if (len == MAX_LEN) {
+            /* the same as far as matches go, so the newer position replaces the node */
+            *smaller = pair[0];
+            *larger = pair[1];
+            break;
+        }
+        if (index-offset < len || input_data[index-offset-len] < input_data[index-len]) {
+            *smaller = node;
+            smaller = &pair[1];
+            node = *smaller;
+            smaller_len = len;
+        } else {
+            *larger = node;
+            larger = &pair[0];
+            node = *larger;
+            larger_len = len;
+        }
+    }
+    return count;
+}
+
+static void zx7_free_finder(zx7_Finder *finder) {
+    free(finder->heads);
+    free(finder->links);
+    free(finder);
+}
+
+static zx7_Finder *zx7_create_finder(int kind) {
+    int tree = kind != ZX7_FINDER_CHAIN;
+    zx7_Finder *finder;
+
+    finder = calloc(1, sizeof(zx7_Finder));
+    if (finder == NULL) {
+        return NULL;
+    }
+    finder->destroy = zx7_free_finder;
+    finder->heads = malloc(256*256*sizeof(int));
+    if (tree) {
+        finder->start = zx7_tree_start;
+        finder->find = zx7_tree_find;
+        finder->links = malloc(TREE_SIZE*2*sizeof(int));
+    } else {
+        finder->start = zx7_chain_start;
+        finder->find = zx7_chain_find;
+    }
+    if (finder->heads == NULL || (tree && finder->links == NULL)) {
+        zx7_free_finder(finder);
+        return NULL;
+    }
+    memset(finder->heads, -1, 256*256*sizeof(int));
+    return finder;
+}
+
+/*
+ * Segment tree over optimal[].bits, giving the cheapest position in a range (the last one on ties).
+ * All lengths within an Elias gamma bucket cost the same but for the cycles of their bytes, so ranking
+ * by bits less slope per position finds the best of them at once.
+ */
+typedef struct zx7_ranking_t {
+    const zx7_Optimal *optimal;
+    int size;
+    int slope;                  /* copy_byte of the cost */
+    int *best;
+} zx7_Ranking;
+
+static int zx7_better(const zx7_Ranking *ranking, int a, int b) {
+    int cost_a;
+    int cost_b;
+
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    cost_a = ranking->optimal[a].bits - ranking->slope*a;
+    cost_b = ranking->optimal[b].bits - ranking->slope*b;
+    return cost_a < cost_b || (cost_a == cost_b && a > b) ? a : b;
+}
+
+/* each position is ranked once, so above a node it does not win nothing changes either */
+static void zx7_rank(zx7_Ranking *ranking, int index) {
+    int i = index+ranking->size;
+    int best;
+
+    ranking->best[i] = index;
+    for (i >>= 1; i > 0; i >>= 1) {
+        best = zx7_better(ranking, ranking->best[2*i], ranking->best[2*i+1]);
+        if (ranking->best[i] == best) {
+            break;
+        }
+        ranking->best[i] = best;
+    }
+}
+
+static int zx7_cheapest(zx7_Ranking *ranking, int first, int last) {
+    int best = -1;
+
+    for (first += ranking->size, last += ranking->size+1; first < last; first >>= 1, last >>= 1) {
+        if (first & 1)
+            best = zx7_better(ranking, best, ranking->best[first++]);
+        if (last & 1)
+            best = zx7_better(ranking, best, ranking->best[--last]);
+    }
+    return best;
+}
+
+/* try lengths first..last of a match at offset for position i, in the order a plain loop would */
+static void zx7_try_lengths(zx7_Optimal *optimal, zx7_Ranking *ranking, const zx7_Cost *cost, int i, int offset, int first, int last) {
+    int bucket;
+    int best;
     int bits;
-    int i;
+    int len;
+
+    while (first <= last) {
+        bucket = 2 << (sizeof(int)*CHAR_BIT-1 - __builtin_clz(first-1));
+        if (bucket > last)
+            bucket = last;
+        if (bucket-first < 8) {
+            for (len = first; len <= bucket; len++) {
+                bits = optimal[i-len].bits + zx7_match_cost(cost, offset, len);
+                if (optimal[i].bits > bits) {
+                    optimal[i].bits = bits;
+                    optimal[i].offset = offset;
+                    optimal[i].len = len;
+                }
+            }
+        } else {
+            best = zx7_cheapest(ranking, i-bucket, i-first);
+            bits = optimal[best].bits + zx7_match_cost(cost, offset, i-best);
+            if (optimal[i].bits > bits) {
+                optimal[i].bits = bits;
+                optimal[i].offset = offset;
+                optimal[i].len = i-best;
+            }
+        }
+        first = bucket+1;
+    }
+}
+
+/* the matches found for a chunk of positions, in the order find() returned them */
+typedef struct zx7_slot_t {
+    int chunk;                  /* chunk held, -1 while a finder thread fills it or the parse is done with it */
+    int *counts;                /* matches of each position */
+    zx7_Match *matches;
+    int capacity;               /* matches it can hold */
+} zx7_Slot;
 
-    memset(matches, 0, sizeof matches);
-    memset(min, 0, sizeof min);
-    memset(max, 0, sizeof max);
+/* everything a compression needs besides the output, sized for the largest input so far */
+struct zx7_context_t {
+    zx7_Finder *finder;
+    zx7_Match *matches;
+    zx7_Optimal *optimal;
+    int *ranking;
+    int capacity;
+    zx7_STATS stats;            /* of the last compression or estimate */
+    int modeled;                /* cycles holds a cost model */
+    zx7_CYCLES cycles;
+    double lambda;
+    zx7_Cost cost;              /* of the last parse */
+    long steps;                 /* finder steps of the last parse */
+    int threads;                /* finder threads for large inputs, 1 for none */
+    int finder_kind;            /* ZX7_FINDER_TREE or ZX7_FINDER_CHAIN */
+    zx7_Finder *finders[ZX7_MAX_THREADS];
+    zx7_Slot *slots;
+    int nr_slots;
+    const int *ceiling;         /* output bytes past which a parse gives up, NULL for none */
+    int ceiling_index;          /* where the last parse gave up, -1 if it did not */
+};
+
+zx7_CONTEXT *zx7_context_create(void) {
+    zx7_CONTEXT *context;
 
-    match_slots = calloc(input_size, sizeof(int));
-    if (match_slots == NULL) {
+    context = calloc(1, sizeof(zx7_CONTEXT));
+    if (context == NULL) {
+        return NULL;
+    }
+    context->threads = 1;
+    context->finder_kind = ZX7_FINDER_TREE;
+    context->finder = zx7_create_finder(ZX7_FINDER_TREE);
+    context->matches = malloc((MAX_OFFSET+1)*sizeof(zx7_Match));
+    if (context->finder == NULL || context->matches == NULL) {
+        zx7_context_free(context);
         return NULL;
     }
+    return context;
+}
 
-    optimal = calloc(input_size, sizeof(zx7_Optimal));
-    if (optimal == NULL) {
-        goto free_match_slots;
+/* counted on dzx7_standard: LDI and LDIR copies, each bit read through a call to the bit reader */
+void zx7_z80_cycles(zx7_CYCLES *cycles) {
+    cycles->literal = 60;
+    cycles->match = 200;
+    cycles->long_offset = 220;
+    cycles->copy_byte = 21;
+    cycles->gamma_bit = 60;
+}
+
+void zx7_context_cost_model(zx7_CONTEXT *context, const zx7_CYCLES *cycles, double lambda) {
+    context->modeled = cycles != NULL;
+    if (cycles != NULL) {
+        context->cycles = *cycles;
     }
+    context->lambda = lambda > 0 ? lambda : 0;
+}
 
-    /* index skipped bytes */
-    for (i = 1; i <= skip; i++) {
-        match_index = input_data[i-1] << 8 | input_data[i];
-        match_slots[i] = matches[match_index];
-        matches[match_index] = i;
+double zx7_context_lambda(const zx7_CONTEXT *context, zx7_CYCLES *cycles) {
+    if (!context->modeled) {
+        return 0;
     }
+    if (cycles != NULL) {
+        *cycles = context->cycles;
+    }
+    return context->lambda;
+}
 
-    /* first byte is always literal */
-    optimal[skip].bits = 8;
+/* resolve the cost model of context, returns 0 when the costs of input_size bytes could overflow an int */
+static int zx7_cost_model(const zx7_CONTEXT *context, int input_size, int quick, zx7_Cost *cost) {
+    const zx7_CYCLES *c = &context->cycles;
+    int weight;
 
-    /* process remaining bytes */
-    for (; i < input_size; i++) {
+    memset(cost, 0, sizeof *cost);
+    cost->bit = 1;
+    cost->literal = 9;
+    if (!context->modeled || context->lambda <= 0 || quick) {
+        return 1;
+    }
+    weight = (int)(context->lambda*COST_SCALE + 0.5);
+    cost->weighted = 1;
+    cost->bit = COST_SCALE;
+    cost->literal = 9*COST_SCALE + weight*c->literal;
+    cost->match = weight*c->match;
+    cost->long_offset = weight*c->long_offset;
+    cost->copy_byte = weight*c->copy_byte;
+    cost->gamma_bit = weight*c->gamma_bit;
 
-        optimal[i].bits = optimal[i-1].bits + 9;
-        match_index = input_data[i-1] << 8 | input_data[i];
-        best_len = 1;
-        for (match = &matches[match_index]; *match != 0 && best_len < MAX_LEN; match = &match_slots[*match]) {
-            offset = i - *match;
-            if (offset > MAX_OFFSET) {
-                *match = 0;
-                break;
+    /* the cheapest parse is never above all literals, and a match only adds its bytes to one */
+    return ((long long)cost->literal + cost->copy_byte)*(input_size+1) + 64LL*cost->bit + cost->match +
+           cost->long_offset + 40LL*cost->gamma_bit < INT_MAX/2;
+}
+
+void zx7_context_threads(zx7_CONTEXT *context, int threads) {
+    context->threads = threads < 1 ? 1 : threads > ZX7_MAX_THREADS ? ZX7_MAX_THREADS : threads;
+#ifdef ZX7_NO_THREADS
+    context->threads = 1;
+#endif
+}
+
+void zx7_context_ceiling(zx7_CONTEXT *context, const int *ceiling) {
+    context->ceiling = ceiling;
+}
+
+int zx7_context_finder(zx7_CONTEXT *context, int kind) {
+    zx7_Finder *finder;
+    int i;
+
+    if (kind != ZX7_FINDER_CHAIN) {
+        kind = ZX7_FINDER_TREE;
+    }
+    if (kind == context->finder_kind) {
+        return 1;
+    }
+    finder = zx7_create_finder(kind);
+    if (finder == NULL) {
+        return 0;
+    }
+    context->finder->destroy(context->finder);
+    context->finder = finder;
+    context->finder_kind = kind;
+
+    /* the finder threads make theirs again on the next pipeline */
+    for (i = 0; i < ZX7_MAX_THREADS; i++) {
+        if (context->finders[i] != NULL) {
+            context->finders[i]->destroy(context->finders[i]);
+            context->finders[i] = NULL;
+        }
+    }
+    return 1;
+}
+
+void zx7_context_free(zx7_CONTEXT *context) {
+    int i;
+
+    if (context == NULL) {
+        return;
+    }
+    if (context->finder != NULL) {
+        context->finder->destroy(context->finder);
+    }
+    for (i = 0; i < ZX7_MAX_THREADS; i++) {
+        if (context->finders[i] != NULL) {
+            context->finders[i]->destroy(context->finders[i]);
+        }
+    }
+    for (i = 0; i < context->nr_slots; i++) {
+        free(context->slots[i].counts);
+        free(context->slots[i].matches);
+    }
+    free(context->slots);
+    free(context->matches);
+    free(context->optimal);
+    free(context->ranking);
+    free(context);
+}
+
+/* the cheapest way to reach position i, given the matches the finder reported there */
+static void zx7_step(zx7_Optimal *optimal, zx7_Ranking *ranking, const zx7_Cost *cost, int i, const zx7_Match *matches, int count, int quick) {
+    int bits;
+    int len;
+    int j;
+
+    optimal[i].bits = optimal[i-1].bits + cost->literal;
+    if (quick) {
+        for (j = 0; j < count; j++) {
+            bits = optimal[i-matches[j].len].bits + zx7_match_cost(cost, matches[j].offset, matches[j].len);
+            if (optimal[i].bits > bits) {
+                optimal[i].bits = bits;
+                optimal[i].offset = matches[j].offset;
+                optimal[i].len = matches[j].len;
             }
+        }
+        return;
+    }
+    for (len = 2, j = 0; j < count; j++) {
+        zx7_try_lengths(optimal, ranking, cost, i, matches[j].offset, len, matches[j].len);
+        len = matches[j].len+1;
+    }
+    zx7_rank(ranking, i);
+}
 
-            for (len = 2; len <= MAX_LEN && i >= skip+len; len++) {
-                if (len > best_len) {
-                    best_len = len;
-                    bits = optimal[i-len].bits + count_bits(offset, len);
-                    if (optimal[i].bits > bits) {
-                        optimal[i].bits = bits;
-                        optimal[i].offset = offset;
-                        optimal[i].len = len;
-                    }
-                } else if (max[offset] != 0 && i+1 == max[offset]+len) {
-                    len = i-min[offset];
-                    if (len > best_len) {
-                        len = best_len;
-                    }
-                }
-                if (i < offset+len || input_data[i-len] != input_data[i-len-offset]) {
-                    break;
-                }
+#define CEILING_CHECK 4096
+
+/*
+ * Whether every parse of the whole input is sure to take more bytes than the ceiling of the context,
+ * checked every CEILING_CHECK positions of an unweighted parse. Past i, each parse has a token ending
+ * there or a match across it, the latter no longer than the longest one ending at i and so following
+ * one of the positions it covers.
+ */
+static int zx7_beyond_ceiling(const zx7_CONTEXT *context, int first, int i, const zx7_Match *matches, int count) {
+    const zx7_Optimal *optimal = context->optimal;
+    int bound = optimal[i].bits;
+    int j;
+
+    if (context->ceiling == NULL || context->cost.weighted || (i-first) % CEILING_CHECK) {
+        return 0;
+    }
+    for (j = count > 0 ? i-matches[count-1].len : i; j < i; j++) {
+        if (bound > optimal[j].bits) {
+            bound = optimal[j].bits;
+        }
+    }
+    return (bound+18+7)/8 > __atomic_load_n(context->ceiling, __ATOMIC_RELAXED);
+}
+
+#ifndef ZX7_NO_THREADS
+
+#define PIPELINE_CHUNK 32768
+
+/*
+ * Matches only depend on the input, so finder threads look for them a chunk of positions at a time while
+ * the calling thread runs the parse over the chunks already found, in order. Each chunk starts a finder of
+ * its own on the MAX_OFFSET positions before it, which finds exactly the matches a single finder would.
+ * A chunk waits for a free slot, so at most nr_slots chunks of matches are held at once.
+ */
+typedef struct zx7_pipeline_t {
+    const unsigned char *input_data;
+    int input_size;
+    int first;
+    int nr_chunks;
+    int next;                   /* next chunk for a finder thread */
+    int consumed;               /* chunks the parse is done with */
+    int failed;
+    long steps;
+    zx7_Slot *slots;
+    int nr_slots;
+    pthread_mutex_t lock;
+    pthread_cond_t found;
+    pthread_cond_t freed;
+} zx7_Pipeline;
+
+typedef struct zx7_pipeline_worker_t {
+    zx7_Pipeline *pipeline;
+    zx7_Finder *finder;
+    pthread_t thread;
+} zx7_PipelineWorker;
+
+static int zx7_slot_reserve(zx7_Slot *slot, int size) {
+    zx7_Match *matches;
+
+    if (slot->capacity >= size) {
+        return 1;
+    }
+    if (size < 2*slot->capacity) {
+        size = 2*slot->capacity;
+    }
+    matches = realloc(slot->matches, size*sizeof(zx7_Match));
+    if (matches == NULL) {
+        return 0;
+    }
+    slot->matches = matches;
+    slot->capacity = size;
+    return 1;
+}
+
+static void *zx7_find_chunks(void *arg) {
+    zx7_PipelineWorker *worker = arg;
+    zx7_Pipeline *pipeline = worker->pipeline;
+    zx7_Finder *finder = worker->finder;
+    zx7_Slot *slot;
+    int chunk;
+    int start;
+    int end;
+    int used;
+    int limit;
+    int ok;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (!pipeline->failed && pipeline->next < pipeline->nr_chunks && pipeline->next-pipeline->consumed >= pipeline->nr_slots) {
+            pthread_cond_wait(&pipeline->freed, &pipeline->lock);
+        }
+        if (pipeline->failed || pipeline->next >= pipeline->nr_chunks) {
+            pthread_mutex_unlock(&pipeline->lock);
+            return NULL;
+        }
+        chunk = pipeline->next++;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        slot = &pipeline->slots[chunk % pipeline->nr_slots];
+        start = pipeline->first+1 + chunk*PIPELINE_CHUNK;
+        end = start+PIPELINE_CHUNK < pipeline->input_size ? start+PIPELINE_CHUNK : pipeline->input_size;
+        ok = zx7_slot_reserve(slot, MAX_OFFSET+1) && finder->start(finder, pipeline->input_data, pipeline->input_size);
+        for (i = start > MAX_OFFSET ? start-MAX_OFFSET : 1; ok && i < start; i++) {
+            finder->find(finder, i, 0, slot->matches);
+        }
+        for (used = 0, i = start; ok && i < end; i++) {
+            ok = zx7_slot_reserve(slot, used+MAX_OFFSET+1);
+            if (ok) {
+                limit = i-pipeline->first < MAX_LEN ? i-pipeline->first : MAX_LEN;
+                slot->counts[i-start] = finder->find(finder, i, limit, slot->matches+used);
+                used += slot->counts[i-start];
+            }
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        if (ok) {
+            slot->chunk = chunk;
+            pipeline->steps += finder->steps;
+        } else {
+            pipeline->failed = 1;
+            pthread_cond_broadcast(&pipeline->freed);
+        }
+        pthread_cond_broadcast(&pipeline->found);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+}
+
+/* the slots and finders of a pipeline with threads finder threads, kept in the context for the next one */
+static int zx7_pipeline_reserve(zx7_CONTEXT *context, int threads) {
+    zx7_Slot *slots;
+    int i;
+
+    for (i = 0; i < threads; i++) {
+        if (context->finders[i] == NULL) {
+            context->finders[i] = zx7_create_finder(context->finder_kind);
+            if (context->finders[i] == NULL) {
+                return 0;
+            }
+        }
+    }
+    if (context->nr_slots < threads+2) {
+        slots = realloc(context->slots, (threads+2)*sizeof(zx7_Slot));
+        if (slots == NULL) {
+            return 0;
+        }
+        context->slots = slots;
+        for (; context->nr_slots < threads+2; context->nr_slots++) {
+            memset(&slots[context->nr_slots], 0, sizeof(zx7_Slot));
+            slots[context->nr_slots].counts = malloc(PIPELINE_CHUNK*sizeof(int));
+            if (slots[context->nr_slots].counts == NULL) {
+                return 0;
             }
-            min[offset] = i+1-len;
-            max[offset] = i;
         }
-        match_slots[i] = matches[match_index];
-        matches[match_index] = i;
     }
+    return 1;
+}
+
+/* parse positions first+1 on from the matches of the finder threads, returns 0 on failure or -1 without threads */
+static int zx7_pipeline(zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int first,
+                        zx7_Ranking *ranking, int quick) {
+    zx7_PipelineWorker workers[ZX7_MAX_THREADS];
+    zx7_Pipeline pipeline;
+    zx7_Slot *slot;
+    int started = 0;
+    int failed = 0;
+    int chunk;
+    int start;
+    int end;
+    int used;
+    int i;
 
-free_match_slots:
-    free(match_slots);
+    memset(&pipeline, 0, sizeof pipeline);
+    pipeline.input_data = input_data;
+    pipeline.input_size = input_size;
+    pipeline.first = first;
+    pipeline.nr_chunks = (input_size-first-1 + PIPELINE_CHUNK-1)/PIPELINE_CHUNK;
+    pipeline.slots = context->slots;
+    pipeline.nr_slots = context->threads+2;
+    for (i = 0; i < pipeline.nr_slots; i++) {
+        pipeline.slots[i].chunk = -1;
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.found, NULL);
+    pthread_cond_init(&pipeline.freed, NULL);
+
+    for (i = 0; i < context->threads; i++) {
+        workers[started].pipeline = &pipeline;
+        workers[started].finder = context->finders[i];
+        if (!pthread_create(&workers[started].thread, NULL, zx7_find_chunks, &workers[started])) {
+            started++;
+        }
+    }
+    if (!started) {
+        pthread_cond_destroy(&pipeline.freed);
+        pthread_cond_destroy(&pipeline.found);
+        pthread_mutex_destroy(&pipeline.lock);
+        return -1;
+    }
+
+    for (chunk = 0; !failed && chunk < pipeline.nr_chunks; chunk++) {
+        slot = &pipeline.slots[chunk % pipeline.nr_slots];
+        pthread_mutex_lock(&pipeline.lock);
+        while (!pipeline.failed && slot->chunk != chunk) {
+            pthread_cond_wait(&pipeline.found, &pipeline.lock);
+        }
+        failed = pipeline.failed;
+        pthread_mutex_unlock(&pipeline.lock);
+        if (failed) {
+            break;
+        }
+
+        start = first+1 + chunk*PIPELINE_CHUNK;
+        end = start+PIPELINE_CHUNK < input_size ? start+PIPELINE_CHUNK : input_size;
+        for (used = 0, i = start; i < end; i++) {
+            zx7_step(context->optimal, ranking, &context->cost, i, slot->matches+used, slot->counts[i-start], quick);
+            if (zx7_beyond_ceiling(context, first, i, slot->matches+used, slot->counts[i-start])) {
+                context->ceiling_index = i;
+                failed = 1;
+                break;
+            }
+            used += slot->counts[i-start];
+        }
+        if (failed) {
+            break;
+        }
+
+        pthread_mutex_lock(&pipeline.lock);
+        slot->chunk = -1;
+        pipeline.consumed++;
+        pthread_cond_broadcast(&pipeline.freed);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    /* a parse that stopped early stops the finder threads too */
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.failed |= failed;
+    pthread_cond_broadcast(&pipeline.freed);
+    pthread_mutex_unlock(&pipeline.lock);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    pthread_cond_destroy(&pipeline.freed);
+    pthread_cond_destroy(&pipeline.found);
+    pthread_mutex_destroy(&pipeline.lock);
+
+    context->steps += pipeline.steps;
+    return !failed;
+}
+
+#endif
+
+/*
+ * Find the cheapest parse of input_data[skip..]. A parse that resumes a stream may open with a match,
+ * otherwise its first byte is a literal. A quick parse only tries the longest length of each match.
+ * Inputs of a few chunks or more find their matches on the finder threads of the context. Returns NULL
+ * on failure, or once sure to exceed the ceiling of the context.
+ */
+static zx7_Optimal *zx7_optimize(zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int resume, int quick) {
+    zx7_Finder *finder = context->finder;
+    zx7_Match *matches = context->matches;
+    zx7_Cost *cost = &context->cost;
+    zx7_Ranking ranking;
+    zx7_Optimal *optimal;
+    int first = resume ? skip-1 : skip;
+    int count;
+    int limit;
+#ifndef ZX7_NO_THREADS
+    int parsed;
+#endif
+    int i;
+
+    context->ceiling_index = -1;
+    if (!zx7_cost_model(context, input_size, quick, cost)) {
+        return NULL;
+    }
+    for (ranking.size = 1; ranking.size < input_size; ranking.size <<= 1)
+        ;
+
+    if (context->capacity < input_size) {
+        free(context->optimal);
+        free(context->ranking);
+        context->capacity = 0;
+        context->optimal = malloc(input_size*sizeof(zx7_Optimal));
+        context->ranking = malloc(2*ranking.size*sizeof(int));
+        if (context->optimal == NULL || context->ranking == NULL) {
+            return NULL;
+        }
+        context->capacity = input_size;
+    }
+    if (!finder->start(finder, input_data, input_size)) {
+        return NULL;
+    }
+    optimal = context->optimal;
+    memset(optimal, 0, input_size*sizeof(zx7_Optimal));
+    ranking.optimal = optimal;
+    ranking.slope = cost->copy_byte;
+    ranking.best = context->ranking;
+    memset(ranking.best, -1, 2*ranking.size*sizeof(int));
+
+    /*
+     * index skipped bytes, only the last MAX_OFFSET of them since no match reaches further back, and the
+     * finders cut off older positions anyway
+     */
+    for (i = first > MAX_OFFSET ? first-MAX_OFFSET : 1; i <= first; i++) {
+        finder->find(finder, i, 0, matches);
+    }
+
+    /* first byte is always literal, unless resuming after the last byte of the previous parse */
+    optimal[first].bits = resume ? 0 : cost->literal-cost->bit;
+    zx7_rank(&ranking, first);
+
+    context->steps = finder->steps;
+#ifndef ZX7_NO_THREADS
+    /* the calling thread finds the matches itself when no finder thread starts */
+    if (context->threads > 1 && input_size-first > 2*PIPELINE_CHUNK && zx7_pipeline_reserve(context, context->threads)) {
+        parsed = zx7_pipeline(context, input_data, input_size, first, &ranking, quick);
+        if (parsed >= 0) {
+            return parsed ? optimal : NULL;
+        }
+    }
+#endif
+
+    /* process remaining bytes */
+    for (; i < input_size; i++) {
+        limit = i-first < MAX_LEN ? i-first : MAX_LEN;
+        count = finder->find(finder, i, limit, matches);
+        zx7_step(optimal, &ranking, cost, i, matches, count, quick);
+        if (zx7_beyond_ceiling(context, first, i, matches, count)) {
+            context->ceiling_index = i;
+            context->steps = finder->steps;
+            return NULL;
+        }
+    }
+    context->steps = finder->steps;
 
     return optimal;
 }
 
-#define read_bytes(n, delta) \
+/* the bit writer state, kept between the segments of a stream; without output_data it only counts */
+typedef struct zx7_encoder_t {
+    unsigned char *output_data;
+    int output_index;
+    int bit_index;
+    int bit_mask;
+    long diff;
+    long delta;
+    zx7_STATS *stats;           /* may be NULL */
+    const zx7_CYCLES *cycles;   /* decode cycles to add up in stats, may be NULL */
+} zx7_Encoder;
+
+#define read_bytes(n) \
 do { \
-   diff += n; \
-   if (diff > delta) \
-       delta = diff; \
+   e->diff += n; \
+   if (e->diff > e->delta) \
+       e->delta = e->diff; \
 } while (0)
 
 #define write_byte(v) \
 do { \
     int v0 = v; \
-    output_data[output_index++] = v0; \
-    diff--; \
+    if (e->output_data != NULL) { \
+        e->output_data[e->output_index] = v0; \
+    } \
+    e->output_index++; \
+    e->diff--; \
 } while (0)
 
 #define write_bit(v) \
 do { \
     int v1 = v; \
-    if (bit_mask == 0) { \
-        bit_mask = 128; \
-        bit_index = output_index; \
+    if (e->bit_mask == 0) { \
+        e->bit_mask = 128; \
+        e->bit_index = e->output_index; \
         write_byte(0); \
     } \
-    if (v1 > 0) { \
-        output_data[bit_index] |= bit_mask; \
+    if (v1 > 0 && e->output_data != NULL) { \
+        e->output_data[e->bit_index] |= e->bit_mask; \
     } \
-    bit_mask >>= 1; \
+    e->bit_mask >>= 1; \
 } while (0)
 
 #define write_elias_gamma(v) \
@@ -167,54 +952,67 @@ do { \
     } \
 } while (0)
 
-unsigned char *zx7_compress(const unsigned char *input_data, int input_size, int skip, int *output_size, long *delta)
-{
-    zx7_Optimal *optimal;
-    unsigned char *output_data;
-    int output_index;
-    int input_index;
-    int bit_index;
-    int bit_mask;
-    int offset1;
-    int mask;
-    int i;
-    long diff;
-
-    optimal = zx7_optimize(input_data, input_size, skip);
-    if (optimal == NULL)
-    {
-        return NULL;
-    }
+static double zx7_seconds(void) {
+    struct timespec now;
 
-    /* calculate and allocate output buffer */
-    input_index = input_size-1;
-    *output_size = (optimal[input_index].bits+18+7)/8;
-    output_data = calloc(*output_size, sizeof(unsigned char));
-    if (!output_data) {
-         return NULL;
-    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
 
-    /* initialize delta */
-    diff = *output_size - input_size + skip;
-    *delta = 0;
+/* link the parse ending at last forward from first, through the bits it no longer needs */
+static void zx7_unreverse(zx7_Optimal *optimal, int first, int last) {
+    int input_index = last;
 
-    /* un-reverse optimal sequence */
     optimal[input_index].bits = 0;
-    while (input_index != skip) {
+    while (input_index != first) {
         int input_prev = input_index - (optimal[input_index].len > 0 ? optimal[input_index].len : 1);
         optimal[input_prev].bits = input_index;
         input_index = input_prev;
     }
+}
 
-    output_index = 0;
-    bit_mask = 0;
+/* encode the parse linked from first on, first is the literal opening the stream unless resuming */
+static void zx7_encode(zx7_Encoder *e, const unsigned char *input_data, zx7_Optimal *optimal, int first, int resume) {
+    int input_index = first;
+    int offset1;
+    int mask;
 
-    /* first byte is always literal */
-    write_byte(input_data[input_index]);
-    read_bytes(1, *delta);
+    if (!resume) {
+        /* first byte is always literal */
+        write_byte(input_data[input_index]);
+        read_bytes(1);
+        if (e->stats != NULL) {
+            e->stats->literals++;
+            e->stats->literal_bits += 8;
+            if (e->cycles != NULL) {
+                e->stats->decode_cycles += e->cycles->literal;
+            }
+        }
+    }
 
     /* process remaining bytes */
     while ((input_index = optimal[input_index].bits) > 0) {
+        if (e->stats != NULL) {
+            e->stats->flag_bits++;
+            if (optimal[input_index].len == 0) {
+                e->stats->literals++;
+                e->stats->literal_bits += 8;
+                if (e->cycles != NULL) {
+                    e->stats->decode_cycles += e->cycles->literal;
+                }
+            } else {
+                e->stats->matches++;
+                e->stats->match_bytes += optimal[input_index].len;
+                /* all but the indicator and a short offset */
+                e->stats->length_bits += count_bits(1, optimal[input_index].len) - 9;
+                e->stats->offset_bits += optimal[input_index].offset > 128 ? 12 : 8;
+                if (e->cycles != NULL) {
+                    e->stats->decode_cycles += e->cycles->match + (long)e->cycles->copy_byte*optimal[input_index].len +
+                                               e->cycles->gamma_bit*(count_bits(1, optimal[input_index].len) - 9) +
+                                               (optimal[input_index].offset > 128 ? e->cycles->long_offset : 0);
+                }
+            }
+        }
         if (optimal[input_index].len == 0) {
 
             /* literal indicator */
@@ -222,7 +1020,7 @@ unsigned char *zx7_compress(const unsigned char *input_data, int input_size, int
 
             /* literal value */
             write_byte(input_data[input_index]);
-            read_bytes(1, *delta);
+            read_bytes(1);
 
         } else {
 
@@ -243,7 +1041,18 @@ unsigned char *zx7_compress(const unsigned char *input_data, int input_size, int
                     write_bit(offset1 & mask);
                 }
             }
-            read_bytes(optimal[input_index].len, *delta);
+            read_bytes(optimal[input_index].len);
+        }
+    }
+}
+
+static void zx7_encode_end(zx7_Encoder *e) {
+    int i;
+
+    if (e->stats != NULL) {
+        e->stats->end_bits += 18;
+        if (e->cycles != NULL) {
+            e->stats->decode_cycles += 17*e->cycles->gamma_bit;
         }
     }
 
@@ -255,8 +1064,303 @@ unsigned char *zx7_compress(const unsigned char *input_data, int input_size, int
         write_bit(0);
     }
     write_bit(1);
+}
+
+/* bits of the stream the parse ending at last encodes, which only its cost tells without a weighted model */
+static int zx7_parse_bits(const zx7_Optimal *optimal, const zx7_Cost *cost, int first, int last) {
+    int bits = 8;
+
+    if (!cost->weighted) {
+        return optimal[last].bits;
+    }
+    while (last != first) {
+        if (optimal[last].len > 0) {
+            bits += count_bits(optimal[last].offset, optimal[last].len);
+            last -= optimal[last].len;
+        } else {
+            bits += 9;
+            last--;
+        }
+    }
+    return bits;
+}
 
-    free(optimal);
+/* parse and encode into a new *output_data, or only count the bytes without it, keeping the stats in the context */
+static int zx7_run(zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, unsigned char **output_data, long *delta, int quick)
+{
+    zx7_STATS *stats = &context->stats;
+    zx7_Optimal *optimal;
+    zx7_Encoder encoder;
+    zx7_Encoder *e = &encoder;
+    int output_size;
+    double start;
+
+    memset(stats, 0, sizeof *stats);
+    start = zx7_seconds();
+    optimal = zx7_optimize(context, input_data, input_size, skip, 0, quick);
+    stats->optimize_seconds = zx7_seconds()-start;
+    stats->finder_steps = context->steps;
+    stats->ceiling_index = context->ceiling_index;
+    if (optimal == NULL)
+    {
+        return -1;
+    }
+
+    /* calculate and allocate output buffer */
+    output_size = (zx7_parse_bits(optimal, &context->cost, skip, input_size-1)+18+7)/8;
+    memset(e, 0, sizeof *e);
+    if (output_data != NULL) {
+        e->output_data = calloc(output_size, sizeof(unsigned char));
+        if (!e->output_data) {
+             return -1;
+        }
+        *output_data = e->output_data;
+    }
+
+    /* initialize delta */
+    e->diff = output_size - input_size + skip;
+    e->stats = stats;
+    e->cycles = context->modeled ? &context->cycles : NULL;
+
+    start = zx7_seconds();
+    zx7_unreverse(optimal, skip, input_size-1);
+    stats->unreverse_seconds = zx7_seconds()-start;
+
+    start = zx7_seconds();
+    zx7_encode(e, input_data, optimal, skip, 0);
+    zx7_encode_end(e);
+    stats->encode_seconds = zx7_seconds()-start;
+
+    if (delta != NULL) {
+        *delta = e->delta;
+    }
+    return output_size;
+}
+
+unsigned char *zx7_context_compress(zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int *output_size, long *delta)
+{
+    unsigned char *output_data = NULL;
+
+    *output_size = zx7_run(context, input_data, input_size, skip, &output_data, delta, 0);
+    return output_data;
+}
+
+void zx7_context_stats(const zx7_CONTEXT *context, zx7_STATS *stats)
+{
+    *stats = context->stats;
+}
+
+int zx7_context_estimate(zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, long *delta)
+{
+    return zx7_run(context, input_data, input_size, skip, NULL, delta, 0);
+}
+
+int zx7_estimate(const unsigned char *input_data, int input_size, int skip, long *delta)
+{
+    zx7_CONTEXT *context;
+    int output_size;
+
+    context = zx7_context_create();
+    if (context == NULL) {
+        return -1;
+    }
+    output_size = zx7_run(context, input_data, input_size, skip, NULL, delta, 0);
+    zx7_context_free(context);
+
+    return output_size;
+}
+
+int zx7_estimate_quick(const unsigned char *input_data, int input_size, int skip, long *delta)
+{
+    zx7_CONTEXT *context;
+    int output_size;
+
+    context = zx7_context_create();
+    if (context == NULL) {
+        return -1;
+    }
+    output_size = zx7_run(context, input_data, input_size, skip, NULL, delta, 1);
+    zx7_context_free(context);
+
+    return output_size;
+}
+
+unsigned char *zx7_compress(const unsigned char *input_data, int input_size, int skip, int *output_size, long *delta)
+{
+    zx7_CONTEXT *context;
+    unsigned char *output_data;
+
+    context = zx7_context_create();
+    if (context == NULL) {
+        return NULL;
+    }
+    output_data = zx7_context_compress(context, input_data, input_size, skip, output_size, delta);
+    zx7_context_free(context);
 
     return output_data;
 }
+
+#define STREAM_SEGMENT 32768
+#define STREAM_LOOKAHEAD 1024
+
+struct zx7_stream_t {
+    zx7_CONTEXT *context;
+    zx7_Encoder encoder;
+    int output_capacity;
+    unsigned char *buffer;      /* up to MAX_OFFSET bytes already encoded, then the pending ones */
+    int capacity;
+    int history;
+    int size;
+    int resume;
+    int failed;
+    long input_total;
+    long output_total;
+    void (*write)(void *user, const unsigned char *output_data, int output_size);
+    void *user;
+};
+
+zx7_STREAM *zx7_stream_create(void (*write)(void *user, const unsigned char *output_data, int output_size), void *user) {
+    zx7_STREAM *stream;
+
+    stream = calloc(1, sizeof(zx7_STREAM));
+    if (stream == NULL) {
+        return NULL;
+    }
+    stream->context = zx7_context_create();
+    stream->capacity = MAX_OFFSET + STREAM_SEGMENT;
+    stream->buffer = malloc(stream->capacity);
+    if (stream->context == NULL || stream->buffer == NULL) {
+        zx7_stream_free(stream);
+        return NULL;
+    }
+    stream->encoder.delta = LONG_MIN;
+    stream->write = write;
+    stream->user = user;
+    return stream;
+}
+
+void zx7_stream_free(zx7_STREAM *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    zx7_context_free(stream->context);
+    free(stream->encoder.output_data);
+    free(stream->buffer);
+    free(stream);
+}
+
+static int zx7_stream_reserve(zx7_STREAM *stream, int bytes) {
+    zx7_Encoder *e = &stream->encoder;
+    unsigned char *output_data;
+
+    if (stream->output_capacity - e->output_index >= bytes) {
+        return 1;
+    }
+    output_data = realloc(e->output_data, e->output_index + bytes);
+    if (output_data == NULL) {
+        return 0;
+    }
+    e->output_data = output_data;
+    stream->output_capacity = e->output_index + bytes;
+    return 1;
+}
+
+/* hand over the bytes no later bit can change, all of them once the stream is complete */
+static void zx7_stream_emit(zx7_STREAM *stream, int all) {
+    zx7_Encoder *e = &stream->encoder;
+    int done = all || e->bit_mask == 0 ? e->output_index : e->bit_index;
+
+    if (done == 0) {
+        return;
+    }
+    stream->write(stream->user, e->output_data, done);
+    memmove(e->output_data, e->output_data+done, e->output_index-done);
+    e->output_index -= done;
+    e->bit_index -= done;
+    stream->output_total += done;
+}
+
+/*
+ * Parse the pending bytes and encode them, leaving the tokens within the last STREAM_LOOKAHEAD bytes to be
+ * parsed again along with what follows, unless final.
+ */
+static int zx7_stream_segment(zx7_STREAM *stream, int final) {
+    zx7_Encoder *e = &stream->encoder;
+    zx7_Optimal *optimal;
+    int first = stream->resume ? stream->history-1 : stream->history;
+    int last = stream->size-1;
+    int consumed;
+    int keep;
+
+    if (stream->size == stream->history) {
+        return 1;
+    }
+
+    optimal = zx7_optimize(stream->context, stream->buffer, stream->size, stream->history, stream->resume, 0);
+    if (optimal == NULL) {
+        return 0;
+    }
+
+    if (!final) {
+        while (last > first && last >= stream->size-STREAM_LOOKAHEAD) {
+            last -= optimal[last].len > 0 ? optimal[last].len : 1;
+        }
+        if (last == first) {
+            /* a single match covers it all */
+            last = stream->size-1;
+        }
+    }
+
+    if (!zx7_stream_reserve(stream, (optimal[last].bits+7)/8+1)) {
+        return 0;
+    }
+    zx7_unreverse(optimal, first, last);
+    zx7_encode(e, stream->buffer, optimal, first, stream->resume);
+
+    /* keep a window of the encoded bytes for the matches of the next parse */
+    consumed = last+1;
+    keep = consumed < MAX_OFFSET ? consumed : MAX_OFFSET;
+    memmove(stream->buffer, stream->buffer+consumed-keep, stream->size-consumed+keep);
+    stream->input_total += consumed-stream->history;
+    stream->size -= consumed-keep;
+    stream->history = keep;
+    stream->resume = 1;
+
+    zx7_stream_emit(stream, 0);
+    return 1;
+}
+
+int zx7_stream_feed(zx7_STREAM *stream, const unsigned char *input_data, int input_size) {
+    int n;
+
+    while (!stream->failed && input_size > 0) {
+        n = stream->capacity-stream->size < input_size ? stream->capacity-stream->size : input_size;
+        memcpy(stream->buffer+stream->size, input_data, n);
+        stream->size += n;
+        input_data += n;
+        input_size -= n;
+        if (stream->size == stream->capacity && !zx7_stream_segment(stream, 0)) {
+            stream->failed = 1;
+        }
+    }
+    return !stream->failed;
+}
+
+int zx7_stream_flush(zx7_STREAM *stream, long *delta) {
+    zx7_Encoder *e = &stream->encoder;
+
+    if (stream->failed || !zx7_stream_segment(stream, 1) || stream->input_total == 0 || !zx7_stream_reserve(stream, 4)) {
+        stream->failed = 1;
+        return 0;
+    }
+    zx7_encode_end(e);
+    zx7_stream_emit(stream, 1);
+
+    /* the largest lead of input over output, measured from the end of both */
+    *delta = e->delta + stream->output_total - stream->input_total;
+    if (*delta < 0) {
+        *delta = 0;
+    }
+    stream->failed = 1;
+    return 1;
+}
@@ -0,0 +1,186 @@
+/*
+ * (c) Copyright 2012-2016 by Einar Saukas. All rights reserved.
+ * Copyright 2017-2025 Matt "MateoConLechuga" Waltz (multithread support)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "zx7.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ZEROS 16  /* lengths up to MAX_LEN need at most 15 leading zeros */
+
+/* the reader state lives in locals of zx7_decode, checks compile away when not checked */
+
+#define read_byte(v) \
+do { \
+    if (checked && input_index >= input_size) \
+        return ZX7_ERROR_STREAM; \
+    v = input_data[input_index++]; \
+} while (0)
+
+#define read_bit(v) \
+do { \
+    bit_mask >>= 1; \
+    if (bit_mask == 0) { \
+        bit_mask = 128; \
+        read_byte(bit_value); \
+    } \
+    v = bit_value & bit_mask ? 1 : 0; \
+} while (0)
+
+/* copy a match forward, a word at a time when source and destination are far enough apart */
+static void copy_match(unsigned char *output_data, int offset, int length) {
+    const unsigned char *source = output_data-offset;
+
+    if (offset == 1) {
+        memset(output_data, *source, length);
+        return;
+    }
+    if (offset >= 8) {
+        while (length >= 8) {
+            memcpy(output_data, source, 8);
+            output_data += 8;
+            source += 8;
+            length -= 8;
+        }
+    }
+    while (length--) {
+        *output_data++ = *source++;
+    }
+}
+
+static inline int zx7_decode(const unsigned char *input_data, int input_size, unsigned char *output_data, int skip, int output_capacity, const int checked)
+{
+    int input_index = 0;
+    int output_index = skip;
+    int bit_mask = 0;
+    int bit_value = 0;
+    int zeros;
+    int length;
+    int offset;
+    int bit;
+    int i;
+
+    /* first byte is always literal */
+    if (checked && output_index >= output_capacity) {
+        return ZX7_ERROR_SPACE;
+    }
+    read_byte(output_data[output_index]);
+    output_index++;
+
+    for (;;) {
+        read_bit(bit);
+        if (!bit) {
+            /* literal value */
+            if (checked && output_index >= output_capacity) {
+                return ZX7_ERROR_SPACE;
+            }
+            read_byte(output_data[output_index]);
+            output_index++;
+            continue;
+        }
+
+        /* sequence length */
+        zeros = 0;
+        do {
+            read_bit(bit);
+        } while (!bit && ++zeros < MAX_ZEROS);
+        if (zeros == MAX_ZEROS) {
+            /* end marker > MAX_LEN */
+            return output_index-skip;
+        }
+        length = 1;
+        while (zeros--) {
+            read_bit(bit);
+            length = length << 1 | bit;
+        }
+        length++;
+
+        /* sequence offset */
+        read_byte(offset);
+        if (offset & 128) {
+            offset &= 127;
+            for (i = 0; i < 4; i++) {
+                read_bit(bit);
+                offset |= bit << (10-i);
+            }
+            offset += 128;
+        }
+        offset++;
+
+        if (checked) {
+            if (offset > output_index) {
+                return ZX7_ERROR_STREAM;
+            }
+            if (length > output_capacity-output_index) {
+                return ZX7_ERROR_SPACE;
+            }
+        }
+        copy_match(&output_data[output_index], offset, length);
+        output_index += length;
+    }
+}
+
+int zx7_decompress_into(const unsigned char *input_data, int input_size, unsigned char *output_data, int skip, int output_capacity)
+{
+    return zx7_decode(input_data, input_size, output_data, skip, output_capacity, 1);
+}
+
+int zx7_decompress_unchecked(const unsigned char *input_data, unsigned char *output_data, int skip)
+{
+    return zx7_decode(input_data, 0, output_data, skip, 0, 0);
+}
+
+unsigned char *zx7_decompress(const unsigned char *input_data, int input_size, const unsigned char *prefix, int skip, int *output_size)
+{
+    unsigned char *output_data;
+    int capacity = input_size*4 + 256;
+    int result;
+
+    /* grow until the whole stream fits */
+    for (;;) {
+        output_data = malloc(skip+capacity);
+        if (!output_data) {
+            return NULL;
+        }
+        if (skip) {
+            memcpy(output_data, prefix, skip);
+        }
+        result = zx7_decompress_into(input_data, input_size, output_data, skip, skip+capacity);
+        if (result != ZX7_ERROR_SPACE || capacity > (1 << 29)) {
+            break;
+        }
+        free(output_data);
+        capacity *= 2;
+    }
+    if (result < 0) {
+        free(output_data);
+        return NULL;
+    }
+
+    memmove(output_data, output_data+skip, result);
+    *output_size = result;
+    return output_data;
+}
@@ -0,0 +1,94 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "zx7.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the tail of the prefix the offsets can reach, which is all a compression ever reads or indexes of it */
+struct zx7_dictionary_t {
+    unsigned char *data;
+    int size;
+};
+
+zx7_DICTIONARY *zx7_dictionary_create(const unsigned char *prefix, int prefix_size)
+{
+    zx7_DICTIONARY *dictionary;
+
+    if (prefix_size < 0) {
+        return NULL;
+    }
+
+    dictionary = calloc(1, sizeof(zx7_DICTIONARY));
+    if (dictionary == NULL) {
+        return NULL;
+    }
+    dictionary->size = prefix_size < MAX_OFFSET ? prefix_size : MAX_OFFSET;
+    dictionary->data = malloc(dictionary->size ? dictionary->size : 1);
+    if (dictionary->data == NULL) {
+        free(dictionary);
+        return NULL;
+    }
+    memcpy(dictionary->data, prefix + prefix_size - dictionary->size, dictionary->size);
+    return dictionary;
+}
+
+void zx7_dictionary_free(zx7_DICTIONARY *dictionary)
+{
+    if (dictionary == NULL) {
+        return;
+    }
+    free(dictionary->data);
+    free(dictionary);
+}
+
+unsigned char *zx7_dictionary_compress(const zx7_DICTIONARY *dictionary, zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int *output_size, long *delta)
+{
+    unsigned char *buffer;
+    unsigned char *output_data;
+
+    if (input_size < 1) {
+        return NULL;
+    }
+
+    /* the compressor reads one buffer, so the asset goes right after the tail */
+    buffer = malloc(dictionary->size + input_size);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    memcpy(buffer, dictionary->data, dictionary->size);
+    memcpy(buffer + dictionary->size, input_data, input_size);
+
+    if (context != NULL) {
+        output_data = zx7_context_compress(context, buffer, dictionary->size + input_size, dictionary->size, output_size, delta);
+    } else {
+        output_data = zx7_compress(buffer, dictionary->size + input_size, dictionary->size, output_size, delta);
+    }
+
+    free(buffer);
+    return output_data;
+}
@@ -0,0 +1,172 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "zx7.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Decompressing in place, the output starts at the bottom of the footprint and the stream ends delta bytes
+ * past the end of the output (or lead bytes lower starts the output, in the rare case the stream is longer
+ * than that).
+ */
+static int zx7_lead(const zx7_ITEM *item) {
+    long lead = item->output_size - item->input_size - item->delta;
+
+    return lead > 0 ? (int)lead : 0;
+}
+
+static int zx7_footprint(const zx7_ITEM *item) {
+    return zx7_lead(item) + item->input_size + (int)item->delta;
+}
+
+/* decompress the stream over its own output in a scratch footprint, the way the target will */
+static int zx7_simulate(const zx7_ITEM *item) {
+    int footprint = zx7_footprint(item);
+    int output_index = zx7_lead(item);
+    unsigned char *image;
+    int result;
+
+    image = malloc(footprint);
+    if (image == NULL) {
+        return 0;
+    }
+    memset(image, 0xa5, footprint);
+    memcpy(image + footprint - item->output_size, item->output_data, item->output_size);
+    result = zx7_decompress_into(image + footprint - item->output_size, item->output_size, image + output_index, 0,
+                                 item->input_size);
+    result = result == item->input_size && !memcmp(image + output_index, item->input_data, item->input_size);
+
+    free(image);
+    return result;
+}
+
+typedef struct zx7_layout_order_t {
+    int footprint;
+    int index;
+} zx7_LAYOUT_ORDER;
+
+static int zx7_footprint_order(const void *a, const void *b) {
+    const zx7_LAYOUT_ORDER *x = a;
+    const zx7_LAYOUT_ORDER *y = b;
+
+    if (x->footprint != y->footprint) {
+        return x->footprint > y->footprint ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+int zx7_plan_layout(zx7_ITEM *items, int nr_items, const zx7_REGION *regions, int nr_regions, int threads, zx7_PLACEMENT *placements)
+{
+    zx7_LAYOUT_ORDER *order;
+    zx7_ITEM *batch;
+    long *next;
+    long *free_bytes;
+    int nr_order = 0;
+    int nr_batch = 0;
+    int unplaced = nr_items;
+    int best;
+    int i;
+    int j;
+
+    for (i = 0; i < nr_items; i++) {
+        placements[i].region = -1;
+        placements[i].output_address = 0;
+        placements[i].input_address = 0;
+        placements[i].footprint = 0;
+    }
+    if (nr_items <= 0) {
+        return 0;
+    }
+
+    order = malloc(nr_items * sizeof(zx7_LAYOUT_ORDER));
+    batch = malloc(nr_items * sizeof(zx7_ITEM));
+    next = malloc((nr_regions > 0 ? nr_regions : 1) * sizeof(long));
+    free_bytes = malloc((nr_regions > 0 ? nr_regions : 1) * sizeof(long));
+    if (order == NULL || batch == NULL || next == NULL || free_bytes == NULL) {
+        free(order);
+        free(batch);
+        free(next);
+        free(free_bytes);
+        return nr_items;
+    }
+    for (j = 0; j < nr_regions; j++) {
+        next[j] = regions[j].address;
+        free_bytes[j] = regions[j].size;
+    }
+
+    /* items against a prefix need it in memory before them, which is not the planner's to place */
+    for (i = 0; i < nr_items; i++) {
+        if (items[i].skip == 0) {
+            batch[nr_batch++] = items[i];
+        }
+        items[i].output_data = NULL;
+    }
+    zx7_compress_batch(batch, nr_batch, threads, NULL, NULL);
+    for (i = 0, j = 0; i < nr_items; i++) {
+        if (items[i].skip == 0) {
+            items[i] = batch[j++];
+        }
+    }
+
+    for (i = 0; i < nr_items; i++) {
+        if (items[i].output_data != NULL) {
+            placements[i].footprint = zx7_footprint(&items[i]);
+            order[nr_order].footprint = placements[i].footprint;
+            order[nr_order++].index = i;
+        }
+    }
+
+    /* best fit decreasing, each item in the fullest region that still holds it */
+    qsort(order, nr_order, sizeof(zx7_LAYOUT_ORDER), zx7_footprint_order);
+    for (i = 0; i < nr_order; i++) {
+        zx7_ITEM *item = &items[order[i].index];
+        zx7_PLACEMENT *placement = &placements[order[i].index];
+
+        best = -1;
+        for (j = 0; j < nr_regions; j++) {
+            if (free_bytes[j] >= placement->footprint && (best < 0 || free_bytes[j] < free_bytes[best])) {
+                best = j;
+            }
+        }
+        if (best < 0 || !zx7_simulate(item)) {
+            continue;
+        }
+
+        placement->region = best;
+        placement->output_address = next[best] + zx7_lead(item);
+        placement->input_address = next[best] + placement->footprint - item->output_size;
+        next[best] += placement->footprint;
+        free_bytes[best] -= placement->footprint;
+        unplaced--;
+    }
+
+    free(order);
+    free(batch);
+    free(next);
+    free(free_bytes);
+    return unplaced;
+}
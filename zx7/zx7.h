@@ -29,4 +29,228 @@
 
 unsigned char *zx7_compress(const unsigned char *input_data, int input_size, int skip, int *output_size, long *delta);
 
+/*
+ * Every buffer zx7_compress allocates besides the output, kept and reused from one call to the next.
+ * Contexts share nothing, so each thread compressing at the same time needs its own.
+ */
+typedef struct zx7_context_t zx7_CONTEXT;
+
+zx7_CONTEXT *zx7_context_create(void);
+
+/*
+ * Find the matches of inputs longer than 64K on this many threads, while the calling thread runs the
+ * parse over them; the output is the same at any number. Matches are about a quarter of the work on
+ * text, so the parse bounds the gain. 1 (the default) keeps it all on the caller.
+ */
+void zx7_context_threads(zx7_CONTEXT *context, int threads);
+
+/*
+ * Make the compressions and estimates of context fail once sure to take more bytes than *ceiling, which
+ * another thread may lower meanwhile, NULL for no limit. Weighted parses are not cut short.
+ */
+void zx7_context_ceiling(zx7_CONTEXT *context, const int *ceiling);
+
+#define ZX7_FINDER_TREE  0   /* binary tree over the window, the default */
+#define ZX7_FINDER_CHAIN 1   /* hash chain, quadratic on long runs, kept to check the tree against */
+
+/*
+ * Match finder for the compressions and estimates made with context from now on; both find the same
+ * matches, so the output does not change. Returns 0 when out of memory, keeping the finder it had.
+ */
+int zx7_context_finder(zx7_CONTEXT *context, int kind);
+
+/* same as zx7_compress */
+unsigned char *zx7_context_compress(zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int *output_size, long *delta);
+
+void zx7_context_free(zx7_CONTEXT *context);
+
+/* what a compression did */
+typedef struct zx7_stats_t {
+    double optimize_seconds;    /* wall time of each phase */
+    double unreverse_seconds;
+    double encode_seconds;
+    long finder_steps;          /* chain or tree nodes the match finder visited */
+    int literals;
+    int matches;
+    int match_bytes;
+    int literal_bits;           /* where the bits of the stream went, these add up to 8 times its size or less */
+    int flag_bits;
+    int length_bits;
+    int offset_bits;
+    int end_bits;
+    long decode_cycles;         /* estimated by the cycle model of the context, 0 without one */
+    int ceiling_index;          /* where the parse gave up, sure to exceed the ceiling, -1 if it did not */
+} zx7_STATS;
+
+/* stats of the last compression or estimate made with the context */
+void zx7_context_stats(const zx7_CONTEXT *context, zx7_STATS *stats);
+
+/* what the target decompressor spends on each part of the stream, in cycles of its CPU */
+typedef struct zx7_cycles_t {
+    int literal;        /* per literal byte, its indicator included */
+    int match;          /* per copy, its indicator and a short offset included */
+    int long_offset;    /* extra for an offset above 128 */
+    int copy_byte;
+    int gamma_bit;      /* per bit of an Elias gamma length */
+} zx7_CYCLES;
+
+/* fill cycles with about the T-states of the standard Z80 decompressor */
+void zx7_z80_cycles(zx7_CYCLES *cycles);
+
+/*
+ * Decoder model for the compressions and estimates made with context from now on, cycles NULL for none.
+ * The stats add up its decode cycles, and with a lambda above 0 the parse minimizes bits plus lambda
+ * times cycles instead of bits alone, trading size for decoding speed. Quick estimates keep to bits.
+ * A weighted parse fails on inputs too long for its costs to fit an int: about 2M bytes with the Z80
+ * model and a lambda of 0.1, 370K at 1.
+ */
+void zx7_context_cost_model(zx7_CONTEXT *context, const zx7_CYCLES *cycles, double lambda);
+
+/* lambda of the cost model of context, 0 without one; cycles (may be NULL) receives the model */
+double zx7_context_lambda(const zx7_CONTEXT *context, zx7_CYCLES *cycles);
+
+typedef struct zx7_chunk_t {
+    unsigned char *output_data;
+    int output_size;
+    int input_offset;   /* first input byte this stream decodes */
+    int input_size;
+    long delta;
+} zx7_CHUNK;
+
+/*
+ * Compress input_data[skip..] as independent streams of chunk_size bytes each, on up to threads threads.
+ * Each stream may reference up to window bytes before its chunk (negative for the full zx7 window), so it
+ * decodes once the preceding data is in place. Release the result with zx7_free_chunks.
+ */
+zx7_CHUNK *zx7_compress_chunks(const unsigned char *input_data, int input_size, int skip, int chunk_size, int window, int threads, int *nr_chunks);
+
+void zx7_free_chunks(zx7_CHUNK *chunks, int nr_chunks);
+
+/*
+ * Output size zx7_compress would give, found without encoding, or -1 on failure. delta (may be NULL)
+ * receives its delta too.
+ */
+int zx7_estimate(const unsigned char *input_data, int input_size, int skip, long *delta);
+
+int zx7_context_estimate(zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, long *delta);
+
+/*
+ * Faster estimate from a parse that only tries the longest length of each match. It is the size of a valid
+ * stream, so it is never below the exact size; on text, tile and random data it came out within 0.7% above.
+ */
+int zx7_estimate_quick(const unsigned char *input_data, int input_size, int skip, long *delta);
+
+typedef struct zx7_item_t {
+    const unsigned char *input_data;
+    int input_size;
+    int skip;
+    unsigned char *output_data;     /* NULL if the item failed */
+    int output_size;
+    long delta;
+    double seconds;                 /* time spent compressing this item */
+    const zx7_CYCLES *cycles;       /* cost model of zx7_context_cost_model, NULL for none */
+    double lambda;
+} zx7_ITEM;
+
+/*
+ * Compress every item on up to threads threads, largest first, each thread reusing one context for all the
+ * items it takes. Items are dealt round robin to per-thread queues, and a thread that runs out steals from the
+ * others. done (may be NULL) is called for each finished item, one at a time. Returns the number of items that
+ * failed; the caller frees the output_data of the rest.
+ */
+int zx7_compress_batch(zx7_ITEM *items, int nr_items, int threads, void (*done)(void *user, zx7_ITEM *item), void *user);
+
+/*
+ * Compress data fed a piece at a time into a single zx7 stream, holding only the last 2176 bytes already
+ * encoded and the ones still pending, so memory stays fixed whatever the input size. The optimal parse runs
+ * on segments of 32K, and the compressed bytes are handed to write as soon as the parse settles them.
+ */
+typedef struct zx7_stream_t zx7_STREAM;
+
+zx7_STREAM *zx7_stream_create(void (*write)(void *user, const unsigned char *output_data, int output_size), void *user);
+
+/* returns 0 on failure, which leaves the stream unusable */
+int zx7_stream_feed(zx7_STREAM *stream, const unsigned char *input_data, int input_size);
+
+/* encode the pending bytes and the end marker, returns 0 on failure or when nothing was fed */
+int zx7_stream_flush(zx7_STREAM *stream, long *delta);
+
+void zx7_stream_free(zx7_STREAM *stream);
+
+/* a span of target memory assets may decompress into */
+typedef struct zx7_region_t {
+    long address;
+    long size;
+} zx7_REGION;
+
+/* where an asset goes, each in a footprint of its own, so an overlay may decompress at any time */
+typedef struct zx7_placement_t {
+    int region;             /* index into the regions, -1 if the item failed or did not fit */
+    long output_address;    /* where it decompresses to */
+    long input_address;     /* where its stream is loaded, over the tail of the output */
+    int footprint;          /* bytes of the region it takes, at least its size plus delta */
+} zx7_PLACEMENT;
+
+/*
+ * Compress items (without skip) on up to threads threads, then lay them out in regions to decompress in
+ * place, largest footprint first, each in the fullest region that still holds it. Every placement is checked
+ * by decompressing the stream over its own output in a scratch copy of its footprint. Returns the number of
+ * items left unplaced; the caller frees the output_data of every item that has it.
+ */
+int zx7_plan_layout(zx7_ITEM *items, int nr_items, const zx7_REGION *regions, int nr_regions, int threads, zx7_PLACEMENT *placements);
+
+/*
+ * A prefix many inputs are compressed against, as with skip, prepared once. Offsets reach 2176 bytes back,
+ * so only that much of the prefix is kept, and the cost of each input no longer grows with the prefix. The
+ * output is the same as compressing prefix and input together with skip at the end of the prefix, and it
+ * decompresses with the whole prefix (or just its tail) in front. A dictionary is only read, so threads
+ * may share it.
+ */
+typedef struct zx7_dictionary_t zx7_DICTIONARY;
+
+zx7_DICTIONARY *zx7_dictionary_create(const unsigned char *prefix, int prefix_size);
+
+void zx7_dictionary_free(zx7_DICTIONARY *dictionary);
+
+/* compress input_data after the dictionary, through context (may be NULL) */
+unsigned char *zx7_dictionary_compress(const zx7_DICTIONARY *dictionary, zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int *output_size, long *delta);
+
+/*
+ * Persistent cache of compressed outputs in the directory path, created if missing. Entries are keyed by a
+ * hash of the input, the skip and the cache version, and hold the output and its delta, so an unchanged
+ * asset is never compressed twice. Several threads or processes may share a cache directory; entries are
+ * written whole and renamed into place.
+ */
+typedef struct zx7_cache_t zx7_CACHE;
+
+zx7_CACHE *zx7_cache_open(const char *path);
+
+void zx7_cache_close(zx7_CACHE *cache);
+
+/* same as zx7_context_compress (or zx7_compress when context is NULL), through the cache */
+unsigned char *zx7_cache_compress(zx7_CACHE *cache, zx7_CONTEXT *context, const unsigned char *input_data, int input_size, int skip, int *output_size, long *delta);
+
+/*
+ * Same as zx7_compress_batch through the cache. Identical items in the batch are looked up and compressed
+ * once, and the rest get copies; items found in the cache report 0 seconds. done gets the items found in the
+ * cache first, then each compressed one as it finishes, then the copies.
+ */
+int zx7_cache_compress_batch(zx7_CACHE *cache, zx7_ITEM *items, int nr_items, int threads, void (*done)(void *user, zx7_ITEM *item), void *user);
+
+#define ZX7_ERROR_STREAM -1
+#define ZX7_ERROR_SPACE -2
+
+/*
+ * Decompress a stream from zx7_compress into output_data[skip..output_capacity-1], where the first skip bytes
+ * already hold the prefix it was compressed against. Returns the number of bytes written after the prefix,
+ * ZX7_ERROR_STREAM for a malformed stream or ZX7_ERROR_SPACE if output_capacity is too small.
+ */
+int zx7_decompress_into(const unsigned char *input_data, int input_size, unsigned char *output_data, int skip, int output_capacity);
+
+/* same as zx7_decompress_into without any checks, only for streams already known to be valid and to fit */
+int zx7_decompress_unchecked(const unsigned char *input_data, unsigned char *output_data, int skip);
+
+/* same as zx7_decompress_into, allocating the output (without the prefix, which may be NULL when skip is 0) */
+unsigned char *zx7_decompress(const unsigned char *input_data, int input_size, const unsigned char *prefix, int skip, int *output_size);
+
 #endif